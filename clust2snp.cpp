@@ -8,9 +8,13 @@
 #include <vector>
 #include <algorithm>
 #include "include.hpp"
+#include "internal/clusters.hpp"
+#include "internal/lcp_clusters.hpp"
+#include "internal/read_store.hpp"
 #include <unistd.h>
 #include <math.h>
 #include <iomanip>
+#include <atomic>
 
 using namespace std;
 
@@ -58,9 +62,31 @@ int lcp = 0;
 int da = 0;
 int pos = 0;
 
+int readahead_buffers = 0;//if >0, read the index with a background I/O thread using this number of buffers
+
 uint64_t n_clust = 0; //number of clusters
 uint64_t n_bases = 0; //number of bases in clusters
 
+uint64_t MAX_C_LEN = 0;//upper bound to the cluster length (option -M)
+vector<uint64_t> clust_len_freq;//number of clusters of each length (up to MAX_C_LEN)
+uint64_t max_len = 0;//max cluster length in clust_len_freq
+
+bool fused = false;//compute the clusters while scanning the EGSA, instead of reading them from file
+
+int threads_def = 1;
+int threads = 0;//number of threads computing the consensus of the candidates
+
+uint64_t mem_budget = 0;//if > 0, max bytes of candidate variants kept in memory (option -B, in MB)
+
+uint64_t shard = 0;//if > 0, process only the clusters of shard number shard (1-based) of n_shards
+uint64_t n_shards = 0;
+
+int K_def = 16;//as in ebwt2clust (fused mode)
+int k = 0;
+
+int min_len_def = 2;//as in ebwt2clust (fused mode)
+int min_len = 0;
+
 void help(){
 
 	cout << "clust2snp [options]" << endl <<
@@ -80,11 +106,22 @@ void help(){
 	"-M <arg>    Maximum cluster length. Read the description of option -p." << endl <<
 	"-x <arg>    Byte size of LCP integers in input EGSA/BCR file (default: " << lcp_def <<  ")." << endl <<
 	"-y <arg>    Byte size of DA integers (read number) in input EGSA/BCR file (default: " << da_def <<  ")." << endl <<
-	"-z <arg>    Byte size of pos integers (position in read) in input EGSA/BCR file (default: " << pos_def <<  ")." << endl << endl <<
+	"-z <arg>    Byte size of pos integers (position in read) in input EGSA/BCR file (default: " << pos_def <<  ")." << endl <<
+	"-a <arg>    Read the EGSA/BCR files with a background I/O thread keeping <arg> (2 or 3) blocks ahead," << endl <<
+	"            instead of memory-mapping them. Useful on network filesystems (default: disabled)." << endl <<
+	"-f          Fused mode: compute the clusters while scanning the EGSA (single pass, no need to run ebwt2clust)." << endl <<
+	"-k <arg>    Fused mode: minimum LCP required in clusters, as -k in ebwt2clust (default: " << K_def << ")." << endl <<
+	"-l <arg>    Fused mode: discard clusters smaller than this value, as -m in ebwt2clust (default: " << min_len_def << ")." << endl <<
+	"-S <i/N>    Process only the clusters of shard i (1 <= i <= N) of N: those starting in a balanced range of the" << endl <<
+	"            EGSA. The clusters file must contain all clusters (merge the shards of ebwt2clust first). Output:" << endl <<
+	"            reads.snp.shard<i>. Merge the shards with merge_shards. Not available with -f." << endl <<
+	"-t <arg>    Number of threads computing the consensus of the left contexts (default: " << threads_def << ")." << endl <<
+	"-B <arg>    Memory budget (MB) for the candidate variants: when it is reached, the candidates found so far are" << endl <<
+	"            processed (stages 2-4) and freed. The output does not change (default: no budget). Not available with -f." << endl << endl <<
 
 
 	"\nTo run clust2snp, you must first build (1) the Enhanced Generalized Suffix Array of the input sequences" << endl <<
-	"and the  cluster file built with ebwt2snp. Output is stored in reads.snp (this  is actually a fasta" << endl <<
+	"and the  cluster file built with ebwt2snp (not needed with option -f). Output is stored in reads.snp (this  is actually a fasta" << endl <<
 	"file), where reads.fasta is the input fasta file." << endl << endl <<
 
 	"Output:  SNPs are output in KisSNP2 format as a fasta file. IMPORTANT: in many cases, each SNP/indel is" << endl <<
@@ -96,23 +133,187 @@ void help(){
 
 /*
  * a pair of DNA segments (encoded as coordinates on reads) containing a potential variant between the
- * two individuals
+ * two individuals. The left contexts are stored in the arena of the candidate_set.
  */
 struct candidate_variant{
 
 	//left contexts, of length k_left. Note: the variant is located at the end of the left context.
 	//in the case of SNP, it is in the last letter of the left context.
 
-	vector<uint64_t> left_context_idx_0; //indexes of the read containing the left context. Individual 0
-	vector<uint64_t> left_context_pos_0; //starting positions of the left context in the read. Individual 0
-
-	vector<uint64_t> left_context_idx_1; //index of the read containing the left context. Individual 1
-	vector<uint64_t> left_context_pos_1; //starting position of the left context in the read. Individual 1
+	uint64_t first; //left contexts [first, first + n_0) are those of individual 0, the following n_1 those of individual 1
+	uint32_t n_0;
+	uint32_t n_1;
 
 	//right contexdts, of length k_right
 
-	uint64_t right_context_idx; //index of the read containing the left context (the same for both individuals)
-	uint64_t right_context_pos; //starting position of the left context in the read
+	uint32_t right_context_idx; //index of the read containing the left context (the same for both individuals)
+	uint32_t right_context_pos; //starting position of the left context in the read
+
+};
+
+/*
+ * the candidate variants, stored contiguously: one record per candidate and a shared arena with the
+ * left contexts of all candidates, as (read number, starting position in the read) pairs. Candidates
+ * are built in place: add_left_context() for the contexts of individual 0, then for those of
+ * individual 1, then commit() (or rollback() to drop them).
+ */
+class candidate_set{
+
+public:
+
+	/*
+	 * add a left context to the candidate being built
+	 */
+	void add_left_context(uint32_t read, uint64_t pos){
+
+		if(pos > 0xFFFF){
+
+			cout << "Error: reads longer than " << 0xFFFF << " bases are not supported." << endl;
+			exit(1);
+
+		}
+
+		ctx_read.push_back(read);
+		ctx_pos.push_back(pos);
+
+	}
+
+	/*
+	 * number of left contexts added to the candidate being built
+	 */
+	uint64_t pending(){
+
+		return ctx_read.size() - next_first();
+
+	}
+
+	/*
+	 * save the candidate being built: its first n_0 left contexts belong to individual 0, the others
+	 * to individual 1
+	 */
+	void commit(uint32_t n_0, uint32_t right_context_idx, uint32_t right_context_pos){
+
+		uint64_t first = next_first();
+
+		C.push_back({first, n_0, uint32_t(ctx_read.size() - first - n_0), right_context_idx, right_context_pos});
+
+	}
+
+	/*
+	 * drop the left contexts of the candidate being built
+	 */
+	void rollback(){
+
+		ctx_read.resize(next_first());
+		ctx_pos.resize(next_first());
+
+	}
+
+	uint64_t size(){
+
+		return C.size();
+
+	}
+
+	candidate_variant & operator[](uint64_t j){
+
+		return C[j];
+
+	}
+
+	/*
+	 * read number and position of the i-th left context of the arena
+	 */
+	uint32_t read(uint64_t i){
+
+		return ctx_read[i];
+
+	}
+
+	uint64_t pos(uint64_t i){
+
+		return ctx_pos[i];
+
+	}
+
+	/*
+	 * read numbers of all left contexts
+	 */
+	vector<uint32_t> & reads(){
+
+		return ctx_read;
+
+	}
+
+	/*
+	 * keep only the candidates j such that keep(j) is true (in the same order)
+	 */
+	template<typename F>
+	void retain(F keep){
+
+		uint64_t m = 0;
+		uint64_t a = 0;//next free position of the arena
+
+		for(uint64_t j = 0; j < C.size(); ++j){
+
+			if(not keep(j)) continue;
+
+			uint64_t n = C[j].n_0 + C[j].n_1;
+
+			for(uint64_t i = 0; i < n; ++i){
+
+				ctx_read[a + i] = ctx_read[C[j].first + i];
+				ctx_pos[a + i] = ctx_pos[C[j].first + i];
+
+			}
+
+			C[m] = C[j];
+			C[m].first = a;
+
+			a += n;
+			m++;
+
+		}
+
+		C.resize(m);
+		ctx_read.resize(a);
+		ctx_pos.resize(a);
+
+	}
+
+	/*
+	 * bytes of memory taken
+	 */
+	uint64_t bytes(){
+
+		return C.capacity() * sizeof(candidate_variant) + ctx_read.capacity() * sizeof(uint32_t) + ctx_pos.capacity() * sizeof(uint16_t);
+
+	}
+
+	/*
+	 * remove all candidates and free the memory
+	 */
+	void clear(){
+
+		vector<candidate_variant>().swap(C);
+		vector<uint32_t>().swap(ctx_read);
+		vector<uint16_t>().swap(ctx_pos);
+
+	}
+
+private:
+
+	//first position of the arena not used by the saved candidates
+	uint64_t next_first(){
+
+		return C.size() == 0 ? 0 : C.back().first + C.back().n_0 + C.back().n_1;
+
+	}
+
+	vector<candidate_variant> C;
+
+	vector<uint32_t> ctx_read;//read numbers
+	vector<uint16_t> ctx_pos;//starting positions of the left contexts in the reads
 
 };
 
@@ -144,7 +345,7 @@ struct variant_t{
  *
  * output: reads and their IDs
  */
-void get_reads(string fasta_path, vector<uint64_t> & read_ranks, vector<string> & out_DNA){
+void get_reads(string fasta_path, vector<uint64_t> & read_ranks, read_arena & out_DNA){
 
 	ifstream fasta;
 	fasta.open(fasta_path);
@@ -181,13 +382,16 @@ void get_reads(string fasta_path, vector<uint64_t> & read_ranks, vector<string>
 
 			ID = line;
 
+			//only the DNA of read read_ranks[i] is kept: the lines of the reads before it are skipped
+			bool keep = j + 1 == read_ranks[i];
+
 			//read DNA
 			getline(fasta,line);
-			DNA = line;
+			DNA = keep ? line : "";
 			while(not fasta.eof() && line[0] != '>'){
 
 				getline(fasta,line);
-				if(line[0] != '>') DNA.append(line);
+				if(keep and line[0] != '>') DNA.append(line);
 
 			}
 
@@ -195,7 +399,7 @@ void get_reads(string fasta_path, vector<uint64_t> & read_ranks, vector<string>
 
 		}
 
-		out_DNA.push_back(DNA);
+		out_DNA.append(read_ranks[i], DNA);
 
 		perc = (i*100)/(read_ranks.size()-1);
 		if(perc >= last_perc+10){
@@ -251,7 +455,7 @@ int dH(string & a, string & b){
  * 	- distance(TTACTTAC, ACCTACTG) = <1,-2>
  *
  */
-pair<int,int> distance(string & a, string & b){
+pair<int,int> distance_(string & a, string & b){
 
 	assert(a.length()==b.length());
 
@@ -301,6 +505,71 @@ pair<int,int> distance(string & a, string & b){
 
 }
 
+/*
+ * as distance_, on a and b packed 2 bits per base (if they are over A,C,G,T and not longer than 64
+ * bases): each alignment is scored with a shift, a XOR and a popcount.
+ */
+pair<int,int> distance(string & a, string & b){
+
+	assert(a.length()==b.length());
+
+	uint128_t A;
+	uint128_t B;
+
+	if(not pack_bases(a, A) or not pack_bases(b, B)) return distance_(a, b);
+
+	int len = a.length();
+
+	//bit 2i set for every position i
+	const uint128_t LOW = (uint128_t(0x5555555555555555ULL) << 64) | 0x5555555555555555ULL;
+
+	//number of mismatches between the first l bases of x and y
+	auto mismatches = [&](uint128_t x, uint128_t y, int l){
+
+		uint128_t z = x ^ y;
+		z = (z | (z >> 1)) & LOW;
+
+		return popcount128(l == 64 ? z : z & ((uint128_t(1) << (2*l)) - 1));
+
+	};
+
+	int dist_no_indel = mismatches(A, B, len);
+
+	if(max_gap==0) return {dist_no_indel,0};
+
+	assert(max_gap<=a.length());
+
+	//best insert in a (remove characters from the right of a) and in b, as in distance_ (ties: shortest insert)
+	int min_ab = 0, min_ab_len = 0;
+	int min_ba = 0, min_ba_len = 0;
+
+	for(int i = 1; i<max_gap+1;++i){
+
+		int d_ab = mismatches(A, B >> (2*i), len - i) + i;
+		int d_ba = mismatches(A >> (2*i), B, len - i) + i;
+
+		if(i == 1 or d_ab < min_ab){ min_ab = d_ab; min_ab_len = i; }
+		if(i == 1 or d_ba < min_ba){ min_ba = d_ba; min_ba_len = i; }
+
+	}
+
+	if(dist_no_indel < min_ab and  dist_no_indel < min_ba){
+
+		//no indels
+		return {dist_no_indel,0};
+
+	}else if(min_ab < min_ba){
+
+		//insert of length min_ab_len in a
+		return {min_ab - min_ab_len, min_ab_len};
+
+	}
+
+	//insert of length min_ba_len in b
+	return {min_ba - min_ba_len, -min_ba_len};
+
+}
+
 /*
  * return consensus letter among all i-th letters of strings in S.
  */
@@ -364,19 +633,87 @@ pair<string, int> consensus(vector<string> & S){
 
 }
 
-vector<candidate_variant> find_variants(vector<t_GSA> & gsa_cluster){
+/*
+ * the filters of find_variants that depend only on the base counts of the two samples (counts[sample][base])
+ * and on the max LCP of the cluster. Returns false if the cluster cannot reflect a variation; otherwise,
+ * fills the sets of frequent bases in indiv 0 and 1 (bit x set if base x is frequent).
+ */
+bool filter_cluster(const unsigned int counts[2][4], uint64_t max_lcp_val, int & frequent_0, int & frequent_1){
+
+	//discard cluster if max LCP is less than k_right
+	if(max_lcp_val < k_right) return false;
+
+	//compute the sets of frequent characters in indiv 0 and 1
+	frequent_0 = 0;
+	frequent_1 = 0;
+
+	for(int c=0;c<4;++c){
+
+		if(counts[0][c] >= mcov_out) frequent_0 |= 1 << c;
+		if(counts[1][c] >= mcov_out) frequent_1 |= 1 << c;
+
+	}
+
+	int n_0 = __builtin_popcount(frequent_0);
+	int n_1 = __builtin_popcount(frequent_1);
+
+	//all variations observed in cluster
+	int n_all = __builtin_popcount(frequent_0 | frequent_1);
+
+	//filter: remove clusters that cannot reflect a variation
+	if(	n_0==0 or // not covered enough
+		n_1==0 or // not covered enough
+		n_0>2 or // we require at most 2 alleles per individual
+		n_1>2 or // we require  at most 2 alleles per individual
+		frequent_0 == frequent_1 or // same alleles: probably both heterozigous / multiple region (and no variants)
+		n_all > 3	//4 or more distinct frequent characters in the cluster (probably multiple region)
+	){
+
+		return false;
+
+	}
+
+	return true;
+
+}
+
+/*
+ * true if the cluster summarized by S might reflect a variation, i.e. if find_variants could
+ * return candidates on its EGSA entries. Clusters containing N are always kept, since the BWT
+ * characters N are counted as random bases.
+ */
+bool filter_summary(cluster_summary & S){
+
+	if(S.n_N > 0) return true;
+
+	unsigned int counts[2][4];
 
-	vector<candidate_variant>  out;
+	for(int sample=0;sample<2;++sample)
+		for(int c=0;c<4;++c)
+			counts[sample][c] = S.counts[sample][c];
 
-	auto counts = vector<vector<unsigned int> >(2,vector<unsigned int>(4,0));
+	int frequent_0;
+	int frequent_1;
+
+	return filter_cluster(counts, S.max_lcp, frequent_0, frequent_1);
+
+}
+
+/*
+ * find the candidate variants in the cluster formed by the length EGSA entries starting at gsa_cluster,
+ * and append them to out. Memory is allocated only to store the candidates.
+ */
+void find_variants(const t_GSA * gsa_cluster, uint64_t length, candidate_set & out){
+
+	unsigned int counts[2][4] = {{0,0,0,0},{0,0,0,0}};
 
 	uint64_t max_lcp_val = 0;//value of max LCP in cluster
 	uint64_t max_lcp_read_idx = 0;//index of read with max LCP in cluster
 	uint64_t max_lcp_read_pos = 0;//position in read where max LCP starts
 
-	for(uint64_t i=0;i<gsa_cluster.size();++i){
+	for(uint64_t i=0;i<length;++i){
 
-		auto e = gsa_cluster[i];
+		auto & e = gsa_cluster[i];
 
 		//find read with max LCP
 		if(e.lcp > max_lcp_val){
@@ -392,236 +729,281 @@ vector<candidate_variant> find_variants(vector<t_GSA> & gsa_cluster){
 
 	}
 
-	//discard cluster if max LCP is less than k_right
-	if(max_lcp_val < k_right) return out;
+	int frequent_0;
+	int frequent_1;
 
-	//compute the lists of frequent characters in indiv 0 and 1
-	vector<unsigned char> frequent_char_0;
-	vector<unsigned char> frequent_char_1;
+	if(not filter_cluster(counts, max_lcp_val, frequent_0, frequent_1)) return;
 
-	for(int c=0;c<4;++c){
+	for(int x0 = 0; x0 < 4; ++x0){
 
-		if(counts[0][c] >= mcov_out) frequent_char_0.push_back(int_to_base(c));
-		if(counts[1][c] >= mcov_out) frequent_char_1.push_back(int_to_base(c));
+		for(int x1 = 0; x1 < 4; ++x1){
 
-	}
+			if(((frequent_0 >> x0) & 1) and ((frequent_1 >> x1) & 1) and x0 != x1){
 
-	std::sort(frequent_char_0.begin(), frequent_char_0.end());
-	std::sort(frequent_char_1.begin(), frequent_char_1.end());
+				unsigned char c0 = int_to_base(x0);
+				unsigned char c1 = int_to_base(x1);
 
-	//all variations observed in cluster
-	auto all_chars = frequent_char_0;
-	all_chars.insert(all_chars.begin(), frequent_char_1.begin(), frequent_char_1.end());
-	std::sort( all_chars.begin(), all_chars.end() );
-	all_chars.erase(std::unique( all_chars.begin(), all_chars.end() ), all_chars.end());
+				uint64_t n_0 = 0;
 
-	//filter: remove clusters that cannot reflect a variation
-	if(	frequent_char_0.size()==0 or // not covered enough
-		frequent_char_1.size()==0 or // not covered enough
-		frequent_char_0.size()>2 or // we require at most 2 alleles per individual
-		frequent_char_1.size()>2 or // we require  at most 2 alleles per individual
-		frequent_char_0 == frequent_char_1 or // same alleles: probably both heterozigous / multiple region (and no variants)
-		all_chars.size() > 3	//4 or more distinct frequent characters in the cluster (probably multiple region)
-	){
+				//left contexts in indiv. 0 and 1, on the reads whose left contexts end with c0 and c1,
+				//respectively.
 
-		return out;
+				for(int sample = 0; sample < 2; ++sample){
 
-	}
+					unsigned char c = sample == 0 ? c0 : c1;
+					uint64_t n = 0;
 
-	for(auto c0 : frequent_char_0){
+					for(uint64_t i=0;i<length and n<consensus_reads;++i){
 
-		for(auto c1 : frequent_char_1){
+						auto & e = gsa_cluster[i];
 
-			if(c0 != c1){
+						if(	e.suff >= k_left and
+							e.bwt == c and
+							(e.text < nr_reads1 ? 0 : 1) == sample and
+							e.lcp >= k_right){ //TODO test
 
-				//compute max length of left context in indiv. 0 and 1, on the reads whose left
-				//contexts end with c0 and c1, respectively.
+							out.add_left_context(e.text, e.suff-k_left);
+							n++;
 
-				vector<uint64_t> left_pos_0;
-				vector<uint64_t> left_idx_0;
+						}
 
-				vector<uint64_t> left_pos_1;
-				vector<uint64_t> left_idx_1;
+					}
 
-				for(uint64_t i=0;i<gsa_cluster.size();++i){
+					if(n == 0) break;
+					if(sample == 0) n_0 = n;
 
-					auto e = gsa_cluster[i];
-					bool sample = e.text < nr_reads1 ? 0 : 1;
-					uint64_t prefix_len = e.suff;
-					unsigned char ch = e.bwt;
-					uint64_t lcp = e.lcp;
+				}
 
-					if(	prefix_len >= k_left and
-						ch == c0 and
-						sample == 0 and
-						lcp >= k_right and //TODO test
-						left_idx_0.size()<consensus_reads){
+				if(n_0 > 0 and out.pending() > n_0){
 
-						left_idx_0.push_back(e.text);
-						left_pos_0.push_back(e.suff-k_left);
+					out.commit(n_0, max_lcp_read_idx, max_lcp_read_pos);
 
-					}
+				}else{
 
-					if(	prefix_len >= k_left and
-						ch == c1 and
-						sample == 1 and
-						lcp >= k_right and //TODO test
-						left_idx_1.size()<consensus_reads){
+					out.rollback();
 
-						left_idx_1.push_back(e.text);
-						left_pos_1.push_back(e.suff-k_left);
+				}
 
-					}
+			}
 
-				}
+		}
 
-				if(left_idx_0.size()>0 and left_idx_1.size()>0){
+	}
 
-					out.push_back(
-						{
+}
 
-							left_idx_0, left_pos_0,
-							left_idx_1, left_pos_1,
-							max_lcp_read_idx, max_lcp_read_pos
+/*
+ * open the read store reads.fasta.packed of the fasta file. Returns false if it does not exist or if
+ * it does not match the fasta file (size and modification time).
+ */
+bool open_read_store(string fasta_path, read_store & store){
 
-						}
-					);
+	string store_path = fasta_path;
+	store_path.append(".packed");
 
-				}
+	if(not store.open(store_path)) return false;
 
-			}
+	struct stat st;
 
-		}
+	if(stat(fasta_path.c_str(), &st) != 0 or uint64_t(st.st_size) != store.fasta_size() or st.st_mtime != store.fasta_mtime()){
+
+		cout << "Warning: " << store_path << " does not match " << fasta_path << ": ignored." << endl;
+		return false;
 
 	}
 
-	return out;
+	return true;
 
 }
 
 /*
- * extracts from the fasta file the DNA surrounding the variants
+ * extracts from the fasta file (or from the read store, if packed is true) the DNA surrounding the
+ * variants
  */
-vector<variant_t> extract_variants(vector<candidate_variant> & candidate_variants, string fasta_path){
+vector<variant_t> extract_variants(candidate_set & candidate_variants, string fasta_path, read_store & store, bool packed){
 
 	vector<variant_t> out;
 
-	vector<uint64_t> read_ranks;
+	read_arena reads;//the reads needed, if they are extracted from the fasta file
+
+	if(packed){
+
+		cout << "(2/4) Reads are accessed in the read store " << fasta_path << ".packed" << endl;
+
+	}else{
 
-	//extract the ranks of all reads we need to process
-	for(auto v : candidate_variants){
+		//extract the ranks of all reads we need to process
+		vector<uint64_t> read_ranks(candidate_variants.reads().begin(), candidate_variants.reads().end());
 
-		read_ranks.insert(read_ranks.end(), v.left_context_idx_0.begin(), v.left_context_idx_0.end());
-		read_ranks.insert(read_ranks.end(), v.left_context_idx_1.begin(), v.left_context_idx_1.end());
-		read_ranks.push_back(v.right_context_idx);
+		for(uint64_t j = 0; j < candidate_variants.size(); ++j) read_ranks.push_back(candidate_variants[j].right_context_idx);
+
+		//sort and remove duplicates
+		std::sort( read_ranks.begin(), read_ranks.end() );
+		auto last = std::unique( read_ranks.begin(), read_ranks.end() );
+		read_ranks.erase(last, read_ranks.end());
+
+		//get the reads, packed in memory
+		get_reads(fasta_path, read_ranks, reads);
 
 	}
 
-	//sort and remove duplicates
-	std::sort( read_ranks.begin(), read_ranks.end() );
-	auto last = std::unique( read_ranks.begin(), read_ranks.end() );
-	read_ranks.erase(last, read_ranks.end());
+	//DNA of the read with rank r from position pos (at most len bases)
+	auto context = [&](uint64_t r, uint64_t pos, uint64_t len){
+
+		return packed ? store.substr(r, pos, len) : reads.substr(r, pos, len);
 
-	vector<string> reads;
+	};
 
-	//get the reads as strings
-	get_reads(fasta_path, read_ranks, reads);
+	//left context (k_left bases) of read r from position pos, packed 2 bits per base in w. False if the
+	//bases are not all A,C,G,T
+	auto packed_context = [&](uint64_t r, uint64_t pos, uint64_t * w){
 
-	//invert read_ranks for fast access
-	auto read_ranks_inv = vector<uint64_t>(read_ranks[read_ranks.size()-1]+1);
+		return packed ? store.packed_substr(r, pos, k_left, w) : reads.packed_substr(r, pos, k_left, w);
 
-	for(uint64_t i=0;i<read_ranks.size();++i)
-		read_ranks_inv[read_ranks[i]] = i;
+	};
 
 	cout << "(3/4) Filtering " << candidate_variants.size() <<  " candidates and computing consensus of left-contexts ... " << endl;
 
+	//candidates are processed in chunks by the threads. The variants of each chunk are then appended in
+	//order, so the output does not depend on the number of threads.
+	const uint64_t chunk_size = 1<<10;
+	uint64_t n_chunks = (candidate_variants.size() + chunk_size - 1) / chunk_size;
+
+	vector<vector<variant_t> > chunk_out(n_chunks);
+	atomic<uint64_t> next_chunk(0);
+
 	uint64_t idx=0;
 	int perc = 0, last_perc=0;
+	mutex progress;
 
-	for(auto v:candidate_variants){
+	auto worker = [&](){
 
-		//left 0
-		cons left0(k_left);
-		for(int j=0; j<v.left_context_idx_0.size(); ++j){
+		//scratch space of the thread, reused for all its candidates
+		cons left(k_left);
+		packed_cons packed_left(k_left <= 64 ? k_left : 64, consensus_reads);
 
-			uint64_t idx = read_ranks_inv[v.left_context_idx_0[j]];
+		vector<string> L;
+		vector<uint128_t> P;
 
-			for(int i=0; i<k_left;++i)
-				left0.increment(i,reads[idx][v.left_context_pos_0[j]+i]);
+		//consensus C of the left contexts [first, first + n) of the candidates, and its support (number of
+		//left contexts within distance max_err). They are packed 2 bits per base if they contain only A,C,G,T.
+		auto left_consensus = [&](uint64_t first, uint64_t n, string & C){
 
-		}
+			int supp = 0;
 
-		int supp0=0;
+			bool fast = k_left <= 64;
 
-		for(int j=0; j<v.left_context_idx_0.size(); ++j){
+			P.clear();
 
-			uint64_t idx = read_ranks_inv[v.left_context_idx_0[j]];
+			for(uint64_t j = first; fast and j < first + n; ++j){
 
-			//compute d_H
-			int d_H=0;
-			for(int i=0; i<k_left;++i)
-				d_H += left0[i] != reads[idx][v.left_context_pos_0[j]+i];
+				uint64_t w[2] = {0,0};
 
-			if(d_H <= max_err) supp0++;
+				fast = packed_context(candidate_variants.read(j), candidate_variants.pos(j), w);
+				P.push_back((uint128_t(w[1]) << 64) | w[0]);
 
-		}
+			}
 
-		//left 1
-		cons left1(k_left);
-		for(int j=0; j<v.left_context_idx_1.size(); ++j){
+			if(fast){
 
-			uint64_t idx = read_ranks_inv[v.left_context_idx_1[j]];
+				packed_left.clear();
 
-			for(int i=0; i<k_left;++i)
-				left1.increment(i,reads[idx][v.left_context_pos_1[j]+i]);
+				for(auto w : P) packed_left.add(w);
+				for(auto w : P) supp += packed_left.distance(w) <= max_err;
 
-		}
+				C = packed_left.to_string();
 
-		int supp1=0;
+				return supp;
 
-		for(int j=0; j<v.left_context_idx_1.size(); ++j){
+			}
 
-			uint64_t idx = read_ranks_inv[v.left_context_idx_1[j]];
+			//left contexts of the reads
+			L.clear();
 
-			//compute d_H
-			int d_H=0;
-			for(int i=0; i<k_left;++i)
-				d_H += left1[i] != reads[idx][v.left_context_pos_1[j]+i];
+			for(uint64_t j = first; j < first + n; ++j)
+				L.push_back(context(candidate_variants.read(j), candidate_variants.pos(j), k_left));
 
-			if(d_H <= max_err) supp1++;
+			left.clear();
+			for(int j=0; j<L.size(); ++j){
 
-		}
+				for(int i=0; i<k_left;++i)
+					left.increment(i,L[j][i]);
+
+			}
+
+			for(int j=0; j<L.size(); ++j){
+
+				//compute d_H
+				int d_H=0;
+				for(int i=0; i<k_left;++i)
+					d_H += left[i] != L[j][i];
+
+				if(d_H <= max_err) supp++;
+
+			}
+
+			C = left.to_string();
+
+			return supp;
+
+		};
+
+		string C0;
+		string C1;
+
+		uint64_t c;
+
+		while((c = next_chunk++) < n_chunks){
+
+			uint64_t end = (c+1)*chunk_size < candidate_variants.size() ? (c+1)*chunk_size : candidate_variants.size();
 
-		if(supp0 > 0 and supp1 > 0){
+			for(uint64_t k = c*chunk_size; k < end; ++k){
 
-			uint64_t r_idx = read_ranks_inv[v.right_context_idx];
+				candidate_variant & v = candidate_variants[k];
 
-			out.push_back(
+				int supp0 = left_consensus(v.first, v.n_0, C0);
+				int supp1 = left_consensus(v.first + v.n_0, v.n_1, C1);
+
+				if(supp0 > 0 and supp1 > 0){
+
+					chunk_out[c].push_back(
+
+						{
+							C0,
+							C1,
+							context(v.right_context_idx, v.right_context_pos, k_right),
+							supp0,
+							supp1
+						}
+
+					);
 
-				{
-					left0.to_string(),
-					left1.to_string(),
-					reads[r_idx].substr(v.right_context_pos,k_right),
-					supp0,
-					supp1
 				}
 
-			);
+			}
 
-		}
+			lock_guard<mutex> lock(progress);
 
-		++idx;
+			idx += end - c*chunk_size;
 
-		perc = (idx*100)/candidate_variants.size();
-		if(perc >= last_perc+1){
+			perc = (idx*100)/candidate_variants.size();
+			if(perc >= last_perc+1){
 
-			last_perc=perc;
-			cout << " " << perc << "% done." << endl;
+				last_perc=perc;
+				cout << " " << perc << "% done." << endl;
+
+			}
 
 		}
 
+	};
 
-	}
+	vector<thread> T;
+
+	for(int t = 0; t < threads; ++t) T.push_back(thread(worker));
+	for(auto & t : T) t.join();
+
+	for(auto & V : chunk_out) out.insert(out.end(), V.begin(), V.end());
 
 	return out;
 
@@ -629,12 +1011,10 @@ vector<variant_t> extract_variants(vector<candidate_variant> & candidate_variant
 
 /*
  * detect the type of variant (SNP/indel/discard if none) and, if not discarded, output to file the two reads per variant testifying it.
+ * id_nr is the number of the next variant saved (variants saved by previous calls are not renumbered).
  */
-void to_file(vector<variant_t> & output_variants, string & out_path){
-
-	ofstream out_file = ofstream(out_path);
+void to_file(vector<variant_t> & output_variants, ofstream & out_file, uint64_t & id_nr){
 
-	uint64_t id_nr = 1;
 	uint64_t idx = 0;
 
 	int perc = 0;
@@ -787,66 +1167,142 @@ void to_file(vector<variant_t> & output_variants, string & out_path){
  */
 void find_events(egsa_stream & EGSA, string & clusters_path, string fasta_path, string out_path){
 
-	ifstream clusters;
-	clusters.open(clusters_path, ios::in | ios::binary);
+	clusters_reader clusters(clusters_path);
+
+	//summaries of the clusters (ebwt2clust -s), if available for these clusters and this -n
+	string summary_path = clusters_path;
+	summary_path.append(".summary");
+
+	uint64_t clusters_size;
+	int64_t clusters_mtime;
+	file_stamp(clusters_path, clusters_size, clusters_mtime);
+
+	summary_reader summaries(summary_path);
+	bool use_summaries = summaries.matches(clusters.size(), clusters_size, clusters_mtime, nr_reads1);
+
+	if(use_summaries){
+
+		cout << "Using the cluster summaries in " << summary_path << endl;
+
+	}else if(summaries.is_open()){
+
+		cout << "Warning: " << summary_path << " does not match the clusters file or the number of reads (-n): ignored." << endl;
+
+	}
+
+	uint64_t discarded = 0;//clusters discarded using the summaries
+
+	uint64_t start;
+	uint64_t length;
+
+	cluster_summary S;
+
+	//clusters processed: [first, last) (all clusters, or those starting in the range of the shard)
+	uint64_t first = 0;
+	uint64_t last = clusters.size();
+
+	if(shard > 0){
+
+		//number of the first cluster starting at or after EGSA position j
+		auto first_from = [&](uint64_t j){
+
+			clusters.seek_position(j);
+			uint64_t c = clusters.position();
+
+			return clusters.next(start, length) and start < j ? c + 1 : c;
+
+		};
+
+		auto R = EGSA.shard(shard, n_shards);
+
+		first = first_from(R.first);
+		last = first_from(R.second);
 
-	uint64_t i = 0;//position on suffix array
+		clusters.seek(first);
+		for(uint64_t c = 0; use_summaries and c < first; ++c) summaries.next(S);
 
-	//read first egsa entry
-	t_GSA e = EGSA.read_el();
+		cout << "Shard " << shard << "/" << n_shards << ": entries [" << R.first << ", " << R.second << "), clusters [" << first << ", " << last << ")" << endl;
 
-	vector<candidate_variant> candidate_variants;
+	}
+
+	candidate_set candidate_variants;
+	uint64_t n_candidates = 0;//candidates found so far
+
+	read_store store;
+	bool packed = open_read_store(fasta_path, store);
+
+	ofstream out_file(out_path);
+	uint64_t id_nr = 1;
+
+	//stages 2-4 on the candidates found so far, which are then freed
+	auto process_candidates = [&](){
+
+		//3. EXTRACT READ SEGMENTS FROM FILE
+		//extract from file the interesting parts of the reads and form the variants to be outputted
+
+		vector<variant_t> output_variants = extract_variants(candidate_variants, fasta_path, store, packed);
+
+		//4. SAVE TO OUTPUT FILE THE VARIANTS
+
+		to_file(output_variants, out_file, id_nr);
+
+		candidate_variants.clear();
+
+	};
 
 	cout << "(1/4) Filtering relevant clusters ... " << endl;
 
+	vector<t_GSA> gsa_cluster;//entries of the current cluster
+
 	uint64_t cl = 0;
 	int perc=0;
 	int last_perc=0;
 
-	while(not clusters.eof()){
+	while(first + cl < last and clusters.next(start, length)){
 
-		//1. EXTRACT EGSA CLUSTER
-
-		uint64_t start;
-		uint16_t length;
+		bool keep = true;
 
-		clusters.read((char*)&start, sizeof(uint64_t));
-		clusters.read((char*)&length, sizeof(uint16_t));
+		if(use_summaries){
 
-		if(length >= mcov_out*2 and length <= max_clust_length){
+			summaries.next(S);
+			keep = filter_summary(S);
+			discarded += not keep;
 
-			while(i < start){
-
-				e = EGSA.read_el();
-				++i;
+		}
 
-			}
+		//1. EXTRACT EGSA CLUSTER
 
-			vector<t_GSA> gsa_cluster;
+		if(keep and length >= mcov_out*2 and length <= max_clust_length){
 
-			while(i < start+length){
+			//jump to the cluster: entries of discarded clusters are never decoded
+			EGSA.seek(start);
 
-				gsa_cluster.push_back(e);
-				e = EGSA.read_el();
-				++i;
+			//the buffer is reused for all clusters
+			if(gsa_cluster.size() < length) gsa_cluster.resize(length);
 
-			}
+			uint64_t len = EGSA.read_block(gsa_cluster.data(), length);
 
 			//now gsa_cluster contains a cluster in the egsa
 
 			//2. EXTRACT EVENTS FROM EGSA CLUSTER
 
-			//find potential variants
-			auto v = find_variants(gsa_cluster);
+			//find potential variants and append them to the candidate variants
+			uint64_t n = candidate_variants.size();
+			find_variants(gsa_cluster.data(), len, candidate_variants);
+			n_candidates += candidate_variants.size() - n;
 
-			//append them to the vector of all candidate variants
-			candidate_variants.insert(candidate_variants.end(), v.begin(), v.end());
+		}
+
+		if(mem_budget > 0 and candidate_variants.bytes() >= mem_budget){
+
+			cout << "Memory budget reached: processing " << candidate_variants.size() << " candidates (" << (candidate_variants.bytes() >> 20) << " MB) ... " << endl;
+			process_candidates();
 
 		}
 
 		cl++;
 
-		perc = (cl*100)/(n_clust-1);
+		perc = (cl*100)/(last - first);
 		if(perc >= last_perc+10){
 
 			last_perc=perc;
@@ -856,57 +1312,37 @@ void find_events(egsa_stream & EGSA, string & clusters_path, string fasta_path,
 
 	}
 
-	cout << "Done. "  << candidate_variants.size() << " potential variants detected (some might be detected twice: on fw and rev strands)" << endl;
-
-	//3. EXTRACT READ SEGMENTS FROM FILE
-	//extract from file the interesting parts of the reads and form the variants to be outputted
-
-	vector<variant_t> output_variants = extract_variants(candidate_variants, fasta_path);
+	cout << "Done. "  << n_candidates << " potential variants detected (some might be detected twice: on fw and rev strands)" << endl;
 
-	//4. SAVE TO OUTPUT FILE THE VARIANTS
+	if(use_summaries) cout << discarded << " clusters discarded using their summaries, without reading the EGSA." << endl;
 
-	to_file(output_variants, out_path);
+	EGSA.print_io_stats();
 
-	clusters.close();
+	process_candidates();
 
 }
 
 /*
- * compute coverage statistics, auto-compute max cluster length
+ * add a cluster to the coverage statistics
  */
-void statistics(string & clusters_path){
-
-	ifstream clusters;
-	clusters.open(clusters_path, ios::in | ios::binary);
-
-	uint64_t MAX_C_LEN = max_clust_length;
-
-	//init with max cluster length 200
-	auto clust_len_freq = vector<uint64_t>(MAX_C_LEN+1,0);
-
-	uint64_t max_len = 0;
-
-	while(not clusters.eof()){
-
-		//read entry in clusters
+void count_cluster(uint64_t length){
 
-		uint64_t start;
-		uint16_t length;
+	if(length <= MAX_C_LEN){
 
-		clusters.read((char*)&start, sizeof(uint64_t));
-		clusters.read((char*)&length, sizeof(uint16_t));
+		clust_len_freq[length]++;
+		max_len = length>max_len ? length : max_len;
 
-		if(length <= MAX_C_LEN){
-
-			clust_len_freq[length]++;
-			max_len = length>max_len ? length : max_len;
+	}
 
-		}
+	n_clust++;
+	n_bases+=length;
 
-		n_clust++;
-		n_bases+=length;
+}
 
-	}
+/*
+ * print coverage statistics, auto-compute max cluster length
+ */
+void print_statistics(){
 
 	uint64_t max = 0;
 	for(int i=1;i<=MAX_C_LEN;++i) max = clust_len_freq[i]*i > max ? clust_len_freq[i]*i : max;
@@ -961,7 +1397,182 @@ void statistics(string & clusters_path){
 
 	cout << "\nCluster sizes allowed: [" << mcov_out*2 << "," << max_clust_length << "]" << endl;
 
-	clusters.close();
+}
+
+/*
+ * compute coverage statistics, auto-compute max cluster length. If ebwt2clust saved the statistics
+ * of the clusters (reads.fasta.clusters.stats), they are loaded instead of scanning the clusters.
+ */
+void statistics(string & clusters_path){
+
+	string stats_path = clusters_path;
+	stats_path.append(".stats");
+
+	uint64_t clusters_size;
+	int64_t clusters_mtime;
+	file_stamp(clusters_path, clusters_size, clusters_mtime);
+
+	clusters_stats stats;
+
+	if(stats.load(stats_path, clusters_size, clusters_mtime)){
+
+		cout << "Cluster statistics loaded from " << stats_path << endl;
+
+		stats.for_each([](uint64_t length, uint64_t count){
+
+			if(length <= MAX_C_LEN){
+
+				clust_len_freq[length] += count;
+				max_len = length>max_len ? length : max_len;
+
+			}
+
+		});
+
+		n_clust = stats.clusters();
+		n_bases = stats.n_bases();
+
+		print_statistics();
+
+		return;
+
+	}
+
+	if(ifstream(stats_path).good()) cout << "Warning: " << stats_path << " does not match the clusters file: ignored." << endl;
+
+	clusters_reader clusters(clusters_path);
+
+	uint64_t start;
+	uint64_t length;
+
+	//read entries in clusters (legacy or compact format)
+	while(clusters.next(start, length)) count_cluster(length);
+
+	print_statistics();
+
+}
+
+
+/*
+ * fused mode: single scan of the EGSA. Clusters are computed as in ebwt2clust and passed directly
+ * to find_variants, without writing/reading the clusters file. The max cluster length is known only
+ * at the end of the scan (it depends on the statistics of all clusters): clusters up to the bound
+ * given with -M are analyzed, and the candidate variants of clusters longer than the max cluster
+ * length are discarded afterwards. The output is the same of ebwt2clust + clust2snp.
+ */
+void find_events_fused(egsa_stream & EGSA, string fasta_path, string out_path){
+
+	uint64_t null = ~uint64_t(0);
+
+	candidate_set candidate_variants;
+	vector<uint64_t> candidate_length;//length of the cluster of each candidate variant
+
+	cout << "(1/4) Computing clusters and filtering relevant clusters ... " << endl;
+
+	const uint64_t block_size = 1<<16;
+
+	//entries in positions [w0, w0 + W.size()): from the start of the cluster still open (if it can
+	//still be analyzed) or from the last position scanned
+	vector<t_GSA> W;
+	uint64_t w0 = 0;
+
+	vector<int_lcp> LCP;
+	chunk_clusters R;
+
+	uint64_t start = null;//start of the cluster open at the end of the chunks scanned so far
+	uint64_t a = 0;//first position of the next chunk
+	bool last_block = false;
+
+	uint64_t n = EGSA.size();
+	int perc=0;
+	int last_perc=0;
+
+	auto emit = [&](uint64_t s, uint64_t e){
+
+		uint64_t length = (e - s) + 1;
+
+		//clusters discarded by ebwt2clust
+		if(length < min_len) return;
+
+		count_cluster(length);
+
+		if(length >= mcov_out*2 and length <= MAX_C_LEN){
+
+			//the virtual entry n may close the last cluster
+			uint64_t end = e + 1 < w0 + W.size() ? e + 1 : w0 + W.size();
+			find_variants(W.data() + (s - w0), end - s, candidate_variants);
+			candidate_length.resize(candidate_variants.size(), length);
+
+		}
+
+	};
+
+	while(not last_block){
+
+		uint64_t have = W.size();
+
+		W.resize(have + block_size);
+		uint64_t len = EGSA.read_block(W.data() + have, block_size);
+		W.resize(have + len);
+
+		last_block = len < block_size;
+
+		//scan all positions whose successor has been read. The (virtual) entry following the last one has LCP 0
+		uint64_t read = w0 + W.size();
+		uint64_t b = last_block ? read : read - 1;
+
+		LCP.resize(b - a + 2);
+
+		for(uint64_t j = 0; j < LCP.size(); ++j){
+
+			uint64_t p = a + j;//position a - 1 + j, plus one
+
+			LCP[j] = p == 0 or p > read ? 0 : W[p - 1 - w0].lcp;
+
+		}
+
+		scan_chunk(LCP.data(), a, b, k, R);
+		stitch(R, start, emit);
+
+		a = b;
+
+		//drop the entries that are no longer needed
+		uint64_t keep = a > 0 ? a - 1 : 0;
+		if(start != null and a - start <= MAX_C_LEN) keep = start < keep ? start : keep;
+
+		W.erase(W.begin(), W.begin() + (keep - w0));
+		w0 = keep;
+
+		perc = n > 0 ? (a*100)/n : 100;
+		if(perc >= last_perc+10){
+
+			last_perc=perc;
+			cout << " " << perc << "% done." << endl;
+
+		}
+
+	}
+
+	close_last(a, start, k, emit);
+
+	print_statistics();
+
+	//keep only the candidates from clusters not longer than the max cluster length
+	candidate_variants.retain([&](uint64_t j){ return candidate_length[j] <= max_clust_length; });
+
+	cout << "Done. "  << candidate_variants.size() << " potential variants detected (some might be detected twice: on fw and rev strands)" << endl;
+
+	EGSA.print_io_stats();
+
+	read_store store;
+	bool packed = open_read_store(fasta_path, store);
+
+	vector<variant_t> output_variants = extract_variants(candidate_variants, fasta_path, store, packed);
+
+	ofstream out_file(out_path);
+	uint64_t id_nr = 1;
+
+	to_file(output_variants, out_file, id_nr);
 
 }
 
@@ -973,7 +1584,7 @@ int main(int argc, char** argv){
 	if(argc < 3) help();
 
 	int opt;
-	while ((opt = getopt(argc, argv, "hi:n:p:v:L:R:m:g:c:x:y:z:e:")) != -1){
+	while ((opt = getopt(argc, argv, "hi:n:p:v:L:R:M:m:g:c:x:y:z:e:a:fk:l:S:t:B:")) != -1){
 		switch (opt){
 			case 'h':
 				help();
@@ -1023,6 +1634,35 @@ int main(int argc, char** argv){
 			case 'z':
 				pos = atoi(optarg);
 			break;
+			case 'a':
+				readahead_buffers = atoi(optarg);
+			break;
+			case 'f':
+				fused = true;
+			break;
+			case 'k':
+				k = atoi(optarg);
+			break;
+			case 'l':
+				min_len = atoi(optarg);
+			break;
+			case 't':
+				threads = atoi(optarg);
+			break;
+			case 'B':
+				mem_budget = atoll(optarg) << 20;
+			break;
+			case 'S':
+				shard = atoll(optarg);
+				n_shards = strchr(optarg, '/') != NULL ? atoll(strchr(optarg, '/') + 1) : 0;
+
+				if(shard == 0 or shard > n_shards){
+
+					cout << "Error: the shard must be given as i/N, with 1 <= i <= N." << endl;
+					exit(1);
+
+				}
+			break;
 			default:
 				help();
 			return -1;
@@ -1041,11 +1681,18 @@ int main(int argc, char** argv){
 	pval = pval==0?pval_def:pval;
 	max_snvs = max_snvs==0?max_snvs_def:max_snvs;
 	mcov_out = mcov_out==0?mcov_out_def:mcov_out;
+	k = k==0?K_def:k;
+	min_len = min_len==0?min_len_def:min_len;
+	threads = threads<=0?threads_def:threads;
+
+	MAX_C_LEN = max_clust_length;
+	clust_len_freq = vector<uint64_t>(MAX_C_LEN+1,0);
 
 	if(input.compare("")==0 or nr_reads1 == 0) help();
 
 	egsa_stream EGSA(input);
 	EGSA.set_bytesizes(lcp,da,pos);
+	if(readahead_buffers > 0) EGSA.set_readahead(readahead_buffers);
 
 	cout << "This is clust2snp." << endl <<
 			"Input file: " << input << endl <<
@@ -1056,7 +1703,7 @@ int main(int argc, char** argv){
 	string clusters_path = input;
 	clusters_path.append(".clusters");
 
-	{
+	if(not fused){
 
 		ifstream ifs(clusters_path);
 
@@ -1071,14 +1718,38 @@ int main(int argc, char** argv){
 
 	}
 
+	if(shard > 0 and fused){
+
+		cout << "Error: sharding (-S) is not available in fused mode (-f)." << endl;
+		exit(1);
+
+	}
+
+	if(mem_budget > 0 and fused){
+
+		cout << "Error: the memory budget (-B) is not available in fused mode (-f)." << endl;
+		exit(1);
+
+	}
+
 	string filename_out = input;
 	filename_out = filename_out.substr(0,filename_out.rfind(".fast"));
 	filename_out.append(".snp");
 
+	if(shard > 0) filename_out.append(".shard" + to_string(shard));
+
 	cout << "Output events will be stored in " << filename_out << endl;
 
-	statistics(clusters_path);
-	find_events(EGSA, clusters_path, input, filename_out);
+	if(fused){
+
+		find_events_fused(EGSA, input, filename_out);
+
+	}else{
+
+		statistics(clusters_path);
+		find_events(EGSA, clusters_path, input, filename_out);
+
+	}
 
 	cout << "Done. " <<endl;
 
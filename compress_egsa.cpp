@@ -0,0 +1,126 @@
+// Copyright (c) 2018, Nicola Prezza.  All rights reserved.
+// Use of this source code is governed
+// by a MIT license that can be found in the LICENSE file.
+
+#include <iostream>
+#include <fstream>
+#include <assert.h>
+#include <vector>
+#include "include.hpp"
+#include <unistd.h>
+
+using namespace std;
+
+string input;
+
+int lcp_def = 1;
+int da_def = 4;
+int pos_def = 1;
+
+int lcp = 0;
+int da = 0;
+int pos = 0;
+
+void help(){
+
+	cout << "compress_egsa [options]" << endl <<
+	"Options:" << endl <<
+	"-h         Print this help" << endl <<
+	"-i <arg>   Input fasta file (REQUIRED)" << endl <<
+	"-x <arg>   Byte size of LCP integers in input EGSA/BCR file (default: " << lcp_def <<  ")." << endl <<
+	"-y <arg>   Byte size of DA integers (read number) in input EGSA/BCR file (default: " << da_def <<  ")." << endl <<
+	"-z <arg>   Byte size of pos integers (position in read) in input EGSA/BCR file (default: " << pos_def <<  ")." << endl << endl <<
+
+	"\nConverts the EGSA (reads.fasta.gesa) or BCR (reads.fasta.out, .out.lcp, .out.pairSA) index of the" << endl <<
+	"input reads into the compressed columnar format reads.fasta.egsa2. When reads.fasta.egsa2 exists," << endl <<
+	"ebwt2clust and clust2snp read it instead of the EGSA/BCR files (options -x, -y, -z are then ignored)," << endl <<
+	"unless the EGSA/BCR files have been rebuilt after the conversion." << endl;
+	 exit(0);
+}
+
+int main(int argc, char** argv){
+
+	if(argc < 2) help();
+
+	int opt;
+	while ((opt = getopt(argc, argv, "hi:x:y:z:")) != -1){
+		switch (opt){
+			case 'h':
+				help();
+			break;
+			case 'i':
+				input = string(optarg);
+			break;
+			case 'x':
+				lcp = atoi(optarg);
+			break;
+			case 'y':
+				da = atoi(optarg);
+			break;
+			case 'z':
+				pos = atoi(optarg);
+			break;
+			default:
+				help();
+			return -1;
+		}
+	}
+
+	lcp = lcp==0?lcp_def:lcp;
+	da = da==0?da_def:da;
+	pos = pos==0?pos_def:pos;
+
+	if(input.compare("")==0) help();
+
+	string filename_out = input;
+	filename_out.append(".egsa2");
+
+	{
+
+		ifstream ifs(filename_out);
+
+		if(ifs.good()){
+
+			cout << "Error: " << filename_out << " already exists. Remove it first." << endl;
+			exit(1);
+
+		}
+
+	}
+
+	egsa_stream EGSA(input);
+	EGSA.set_bytesizes(lcp,da,pos);
+
+	cout << "This is compress_egsa. Input file: " << input << endl;
+
+	egsa2_writer out(filename_out);
+
+	const uint64_t block_size = 1<<16;
+	auto B = vector<t_GSA>(block_size);
+
+	uint64_t n = 0;
+	uint64_t len;
+
+	do{
+
+		len = EGSA.read_block(B.data(), block_size);
+
+		for(uint64_t j = 0; j < len; ++j) out.append(B[j].text, B[j].suff, B[j].lcp, B[j].bwt);
+
+		n += len;
+
+	}while(len == block_size);
+
+	//identifies the index the entries were read from: a stale egsa2 file is then ignored
+	uint64_t source_size;
+	int64_t source_mtime;
+	index_stamp(input, source_size, source_mtime);
+
+	out.close(source_size, source_mtime);
+
+	uint64_t in_bytes = n * (lcp + da + pos + 1);
+
+	cout << "Done. " << n << " entries compressed from " << in_bytes << " to " << out.bytes() << " bytes (" <<
+			(out.bytes() > 0 ? double(in_bytes)/double(out.bytes()) : 0) << "x). Output saved to " << filename_out << endl;
+
+}
@@ -7,6 +7,9 @@
 #include <assert.h>
 #include <vector>
 #include "include.hpp"
+#include "internal/lcp_clusters.hpp"
+#include "internal/clusters.hpp"
+#include "internal/mk_index.hpp"
 #include <unistd.h>
 
 using namespace std;
@@ -19,6 +22,7 @@ int min_def = 2; //Discard clusters smaller than this value
 int K_def = 16; //require an LCP of at least k inside clusters
 int k = 0;
 string input;
+string output;//output file (default: input.clusters)
 
 int lcp_def = 1;
 int da_def = 4;
@@ -28,6 +32,19 @@ int lcp = 0;
 int da = 0;
 int pos = 0;
 
+int readahead_buffers = 0;//if >0, read the index with a background I/O thread using this number of buffers
+
+int threads_def = 1;
+int threads = 0;//number of threads computing the clusters
+
+bool summary = false;//save the summaries of the clusters (reads.fasta.clusters.summary)
+uint64_t nr_reads1 = 0;//number of reads in the first sample (needed by the summaries)
+
+bool mk_index = false;//save the multi-k cluster index (reads.fasta.mkidx)
+
+uint64_t shard = 0;//if > 0, compute only the clusters of shard number shard (1-based) of n_shards
+uint64_t n_shards = 0;
+
 
 int min_len=0;
 
@@ -36,104 +53,267 @@ void help(){
 	cout << "ebwt2clust [options]" << endl <<
 	"Options:" << endl <<
 	"-h         Print this help" << endl <<
-	"-i <arg>   Input fasta file (REQUIRED)" << endl <<
+	"-i <arg>   Input fasta file (REQUIRED). Use - to read the EGSA from standard input, or give the" << endl <<
+	"           path of a named pipe: the EGSA records are then read sequentially from the pipe." << endl <<
+	"-o <arg>   Output clusters file (default: input file name with extension .clusters;" << endl <<
+	"           REQUIRED when the EGSA is read from a pipe)." << endl <<
 	"-k <arg>   Minimum LCP required in clusters (default: " << K_def << ")" << endl <<
 	"-m <arg>   Discard clusters smaller than this value (default: " << min_def << ")" << endl <<
 	"-x <arg>   Byte size of LCP integers in input EGSA/BCR file (default: " << lcp_def <<  ")." << endl <<
 	"-y <arg>   Byte size of DA integers (read number) in input EGSA/BCR file (default: " << da_def <<  ")." << endl <<
-	"-z <arg>   Byte size of pos integers (position in read) in input EGSA/BCR file (default: " << pos_def <<  ")." << endl << endl <<
+	"-z <arg>   Byte size of pos integers (position in read) in input EGSA/BCR file (default: " << pos_def <<  ")." << endl <<
+	"-a <arg>   Read the EGSA/BCR files with a background I/O thread keeping <arg> (2 or 3) blocks ahead," << endl <<
+	"           instead of memory-mapping them. Useful on network filesystems (default: disabled)." << endl <<
+	"-t <arg>   Number of threads (default: " << threads_def << "). Not available when the EGSA is read from a pipe." << endl <<
+	"-s         Save also a summary of each cluster (base counts per sample, max LCP) in the output" << endl <<
+	"           file with extension .summary: clust2snp uses it to discard clusters without reading" << endl <<
+	"           the EGSA. Requires -n. Not available when the EGSA is read from a pipe." << endl <<
+	"-n <arg>   Number of reads in the first sample, as in clust2snp (used only with -s)." << endl <<
+	"-I         Save also the multi-k cluster index reads.fasta.mkidx, from which mkidx2clust derives" << endl <<
+	"           the clusters for any k >= the one given with -k (and any -m), without reading the EGSA." << endl <<
+	"           Not available when the EGSA is read from a pipe." << endl <<
+	"-S <i/N>   Compute only the clusters of shard i (1 <= i <= N) of N: a balanced range of the EGSA whose" << endl <<
+	"           boundaries are moved so that no cluster is split. Output (default): reads.fasta.clusters.shard<i>." << endl <<
+	"           Merge the shards with merge_shards. Not available with -s, -I, or when the EGSA is read from a pipe." << endl << endl <<
 
 	"\nTo run ebwt2clust, you must  first build the Enhanced Generalized  Suffix Array of the input" << endl <<
 	"sequences. The EGSA must be stored in the input file's folder adding extension .gesa to the" << endl <<
 	"name of the input file (github.com/felipelouza/egsa), or in three files with extensions" << endl <<
 	".out, .out.lcp, .out.pairSA computed using the BCR algorithm " << endl <<
-	"(https://github.com/giovannarosone/BCR_LCP_GSA). Output is stored in reads.fasta.clusters." << endl;
+	"(https://github.com/giovannarosone/BCR_LCP_GSA). Output is stored in reads.fasta.clusters" << endl <<
+	"(compact format, version 2: see internal/clusters.hpp)." << endl;
 	 exit(0);
 }
 
-void append_entry(ofstream & out, uint64_t start, uint16_t length){
+/*
+ * reads the EGSA entries of the clusters through a second stream, to save their summaries (-s) and/or
+ * the multi-k cluster index (-I). The clusters are reported in increasing order, so the stream only
+ * moves forward.
+ */
+class cluster_extras{
+
+public:
+
+	cluster_extras(string & summary_path, string & index_path) : EGSA(input, summary ? col_text | col_lcp | col_bwt : col_lcp){
+
+		EGSA.set_bytesizes(lcp,da,pos);
+		if(readahead_buffers > 0) EGSA.set_readahead(readahead_buffers);
+
+		if(summary) S = unique_ptr<summary_writer>(new summary_writer(summary_path));
+		if(mk_index) I = unique_ptr<mk_index_writer>(new mk_index_writer(index_path, k));
+
+	}
+
+	/*
+	 * cluster [start, start + length). If saved is false, the cluster has been discarded
+	 * (too short): it is stored only in the multi-k index.
+	 */
+	void add(uint64_t start, uint64_t length, bool saved){
+
+		text.resize(length);
+		L.resize(length);
+		bwt.resize(length);
+
+		EGSA.seek(start);
+		uint64_t len = EGSA.read_columns(summary ? text.data() : NULL, NULL, L.data(), summary ? bwt.data() : NULL, length);
+
+		//a cluster can contain the (virtual) entry following the last one, which has LCP 0
+		for(uint64_t j = len; j < length; ++j) L[j] = 0;
+
+		if(I != NULL) I->append(start, L.data(), length);
+
+		length = len;
+
+		if(S == NULL or not saved) return;
+
+		cluster_summary CS = {};
+
+		for(uint64_t j = 0; j < length; ++j){
+
+			CS.max_lcp = L[j] > CS.max_lcp ? L[j] : CS.max_lcp;
+
+			if(bwt[j] == 'N' or bwt[j] == 'n'){
+
+				CS.n_N++;
+
+			}else{
+
+				CS.counts[text[j] < nr_reads1 ? 0 : 1][base_to_int(bwt[j])]++;
+
+			}
+
+		}
+
+		S->append(CS);
+
+	}
+
+	void close(uint64_t clusters_file_size, int64_t clusters_file_mtime){
+
+		if(S != NULL) S->close(nr_reads1, clusters_file_size, clusters_file_mtime);
+		if(I != NULL) I->close();
+
+	}
+
+private:
+
+	egsa_stream EGSA;
+
+	unique_ptr<summary_writer> S;
+	unique_ptr<mk_index_writer> I;
+
+	vector<int_text> text;
+	vector<int_lcp> L;
+	vector<int8> bwt;
+
+};
+
+unique_ptr<cluster_extras> EXTRAS;//NULL if neither summaries nor the multi-k index are saved
+
+void append_entry(clusters_writer & out, uint64_t start, uint64_t length){
 
 	if(length >=min_len){
 
-		out.write((char*)&start, sizeof(uint64_t));
-		out.write((char*)&length, sizeof(uint16_t));
+		out.append(start, length);
 
 	}
 
+	if(EXTRAS != NULL) EXTRAS->add(start, length, length >= min_len);
+
 }
 
 /*
- * clusters = regions between local LCP minima (excluding tails where LCP < k)
+ * clusters = regions between local LCP minima (excluding tails where LCP < k). The stream starts
+ * at entry begin (0, unless only a shard is processed).
  */
-void cluster_lm(egsa_stream & EGSA,ofstream & out){
+void cluster_lm(egsa_stream & EGSA,clusters_writer & out, uint64_t begin){
 
 	uint64_t null = ~uint64_t(0);
 
-	uint64_t start = null;		//start position of cluster
-	uint64_t i = 0;			//current BWT position
-	uint64_t off = 0;		//current offset in cluster
+	uint64_t start = null;		//start position of the cluster open at the end of the chunks scanned so far
+	uint64_t a = begin;		//first position of the next chunk
 
-	uint64_t prev_lcp = null;//previous LCP value
+	//only the LCP column is needed: read it in blocks
+	const uint64_t block_size = 1<<16;
+	auto LCP = vector<int_lcp>(block_size+2);
 
-	//find local minima in the LCP
-	t_GSA e1 = EGSA.read_el();
-	t_GSA e2 = EGSA.read_el();
-	t_GSA e3;
+	//LCP[0, have) = LCP values in positions [a-1, a-1+have)
+	uint64_t have = 1;
+	bool last_block = false;
 
-	start = e1.lcp >= k ? 0 :
-			e2.lcp >= k ? 1 : null;
+	chunk_clusters R;
 
-	i = 1;//index of e2
+	uint64_t n_clust_out = 0;//number of clusters in output
 
-	unsigned int n_clust_out = 0;//number of clusters in output
+	auto emit = [&](uint64_t s, uint64_t e){
 
-	while(not EGSA.eof()){
+		append_entry(out, s, (e - s) + 1);
+		n_clust_out++;
 
-		//read next value
-		e3 = EGSA.read_el();
+	};
 
-		//cout << e3.text << " " << e3.suff << " " << e3.lcp << " " << char(e3.bwt) << endl;
+	while(not last_block){
 
-		//e2 is start of a (possibly flat) local minima
-		if(		start != null and
-					(		(e1.lcp > e2.lcp and e2.lcp <= e3.lcp) or
-							e3.lcp < k
-					)
-					){
+		uint64_t len = EGSA.read_columns(NULL, NULL, LCP.data() + have, NULL, LCP.size() - have);
 
-			uint16_t length = (i - start) + 1; //this cluster ends in e2
-			append_entry(out, start, length);
-			n_clust_out++;
+		//the (virtual) entry following the last one has LCP 0: this closes the last cluster
+		if(len < LCP.size() - have){
 
-			start = null;
+			LCP[have + len++] = 0;
+			last_block = true;
 
 		}
 
-		e1 = e2;
-		e2 = e3;
-		++i;
+		have += len;
 
-		if(start==null and e2.lcp >= k){
+		//scan all positions whose successor has been read
+		uint64_t b = a + have - 2;
 
-			start = i;
+		scan_chunk(LCP.data(), a, b, k, R);
+		stitch(R, start, emit);
 
-		}
+		//the next chunk needs the LCP values in positions b-1 and b
+		LCP[0] = LCP[have-2];
+		LCP[1] = LCP[have-1];
+		have = 2;
+		a = b;
 
 	}
 
-	/*
-	 * check if last cluster was closed. If not, output it
-	 */
-	if(start != null){
+	close_last(a, start, k, emit);
+
+	cout << "Done. " << n_clust_out << " clusters saved to output file." << endl;
+
+}
+
+/*
+ * parallel version of cluster_lm on entries [begin, n): the LCP array is split in chunks, which are
+ * read (each through its own cursor on the index) and scanned by the threads, a round of one chunk per
+ * thread at a time. The chunks are then stitched in order: the output is identical to the one of cluster_lm.
+ */
+void cluster_lm_parallel(egsa_stream & EGSA,clusters_writer & out, uint64_t begin, uint64_t n){
+
+	uint64_t null = ~uint64_t(0);
+
+	const uint64_t chunk_size = 1<<20;
+
+	uint64_t start = null;//start of the cluster open at the end of the chunks stitched so far
+	uint64_t n_clust_out = 0;
 
-		uint16_t length = (i - start) + 1; //this cluster ends in e2
-		append_entry(out, start, length);
+	auto emit = [&](uint64_t s, uint64_t e){
+
+		append_entry(out, s, (e - s) + 1);
 		n_clust_out++;
 
-		start = null;
+	};
+
+	vector<chunk_clusters> R(threads);
+	vector<vector<int_lcp> > LCP(threads, vector<int_lcp>(chunk_size + 2));
+
+	for(uint64_t round_start = begin; round_start < n; round_start += threads * chunk_size){
+
+		vector<thread> T;
+
+		for(int t = 0; t < threads; ++t){
+
+			uint64_t a = round_start + t * chunk_size;
+
+			if(a >= n) break;
+
+			uint64_t b = a + chunk_size < n ? a + chunk_size : n;
+
+			T.push_back(thread([&, t, a, b](){
+
+				//read LCP values in [a-1, b], where the (virtual) entry following the last one has LCP 0
+				uint64_t from = a > 0 ? a - 1 : 0;
+				uint64_t to = b < n ? b + 1 : n;
+
+				auto C = EGSA.cursor(from, to);
+
+				int_lcp * L = LCP[t].data();
+
+				L[0] = 0;
+				L[b - a + 1] = 0;
+
+				C->read_columns(NULL, NULL, L + (a > 0 ? 0 : 1), NULL, to - from);
+
+				scan_chunk(L, a, b, k, R[t]);
+
+			}));
+
+		}
+
+		for(uint64_t t = 0; t < T.size(); ++t){
+
+			T[t].join();
+			stitch(R[t], start, emit);
+
+		}
 
 	}
 
+	close_last(n, start, k, emit);
+
 	cout << "Done. " << n_clust_out << " clusters saved to output file." << endl;
 
 }
@@ -143,7 +323,7 @@ int main(int argc, char** argv){
 	if(argc < 2) help();
 
 	int opt;
-	while ((opt = getopt(argc, argv, "hk:i:m:x:y:z:")) != -1){
+	while ((opt = getopt(argc, argv, "hk:i:o:m:x:y:z:a:t:sn:IS:")) != -1){
 		switch (opt){
 			case 'h':
 				help();
@@ -157,6 +337,9 @@ int main(int argc, char** argv){
 			case 'i':
 				input = string(optarg);
 			break;
+			case 'o':
+				output = string(optarg);
+			break;
 			case 'x':
 				lcp = atoi(optarg);
 			break;
@@ -166,6 +349,32 @@ int main(int argc, char** argv){
 			case 'z':
 				pos = atoi(optarg);
 			break;
+			case 'a':
+				readahead_buffers = atoi(optarg);
+			break;
+			case 't':
+				threads = atoi(optarg);
+			break;
+			case 's':
+				summary = true;
+			break;
+			case 'n':
+				nr_reads1 = atoll(optarg);
+			break;
+			case 'I':
+				mk_index = true;
+			break;
+			case 'S':
+				shard = atoll(optarg);
+				n_shards = strchr(optarg, '/') != NULL ? atoll(strchr(optarg, '/') + 1) : 0;
+
+				if(shard == 0 or shard > n_shards){
+
+					cout << "Error: the shard must be given as i/N, with 1 <= i <= N." << endl;
+					exit(1);
+
+				}
+			break;
 			default:
 				help();
 			return -1;
@@ -176,23 +385,129 @@ int main(int argc, char** argv){
 	da = da==0?da_def:da;
 	pos = pos==0?pos_def:pos;
 
+	threads = threads<=0?threads_def:threads;
+
 	k = k==0?K_def:k;
 	min_len = min_len==0?min_def:min_len;
 
 	if(input.compare("")==0) help();
 
-	egsa_stream EGSA(input);
+	struct stat st;
+	bool from_pipe = input.compare("-")==0 or (stat(input.c_str(), &st) == 0 and S_ISFIFO(st.st_mode));
+
+	if(from_pipe and output.compare("")==0){
+
+		cout << "Error: the output file (-o) is required when the EGSA is read from a pipe." << endl;
+		exit(1);
+
+	}
+
+	if(summary and nr_reads1 == 0){
+
+		cout << "Error: the summaries of the clusters (-s) require the number of reads in the first sample (-n)." << endl;
+		exit(1);
+
+	}
+
+	if(summary and from_pipe){
+
+		cout << "Error: the summaries of the clusters (-s) are not available when the EGSA is read from a pipe." << endl;
+		exit(1);
+
+	}
+
+	if(mk_index and from_pipe){
+
+		cout << "Error: the multi-k cluster index (-I) is not available when the EGSA is read from a pipe." << endl;
+		exit(1);
+
+	}
+
+	if(shard > 0 and (summary or mk_index or from_pipe)){
+
+		cout << "Error: sharding (-S) is not available with -s, -I, or when the EGSA is read from a pipe." << endl;
+		exit(1);
+
+	}
+
+	//clusters are computed from the LCP alone
+	egsa_stream EGSA(input, col_lcp);
 	EGSA.set_bytesizes(lcp,da,pos);
+	if(readahead_buffers > 0) EGSA.set_readahead(readahead_buffers);
 
 	cout << "This is ebwt2clust. Input file: " << input << endl;
 
-	string filename_out = input;
-	filename_out.append(".clusters");
-	ofstream out;
-	out.open(filename_out, ios::out | ios::binary);
+	string filename_out = output;
+
+	if(filename_out.compare("")==0){
+
+		filename_out = input;
+		filename_out.append(".clusters");
+
+		if(shard > 0) filename_out.append(".shard" + to_string(shard));
+
+	}
+
+	//entries processed: the whole index, or the range of the shard
+	uint64_t begin = 0;
+	uint64_t end = EGSA.size();
+
+	if(shard > 0){
+
+		auto R = EGSA.shard(shard, n_shards, k);
+
+		begin = R.first;
+		end = R.second;
+
+		EGSA.set_range(begin, end);
+
+		cout << "Shard " << shard << "/" << n_shards << ": entries [" << begin << ", " << end << ")" << endl;
+
+	}
+
+	clusters_writer out(filename_out);
+
+	if(summary or mk_index){
+
+		string filename_summary = filename_out;
+		filename_summary.append(".summary");
 
-	cluster_lm(EGSA,out);
+		string filename_index = input;
+		filename_index.append(".mkidx");
+
+		EXTRAS = unique_ptr<cluster_extras>(new cluster_extras(filename_summary, filename_index));
+
+	}
+
+	if(threads > 1 and EGSA.is_pipe()){
+
+		cout << "Warning: the EGSA is read from a pipe, using only one thread." << endl;
+		threads = 1;
+
+	}
+
+	if(threads > 1){
+
+		cluster_lm_parallel(EGSA,out,begin,end);
+
+	}else{
+
+		cluster_lm(EGSA,out,begin);
+
+	}
+
+	EGSA.print_io_stats();
 
 	out.close();
 
+	if(EXTRAS != NULL){
+
+		uint64_t clusters_size;
+		int64_t clusters_mtime;
+		file_stamp(filename_out, clusters_size, clusters_mtime);
+
+		EXTRAS->close(clusters_size, clusters_mtime);
+
+	}
+
 }
@@ -1,4 +1,19 @@
 #include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "internal/egsa2.hpp"
 
 using namespace std;
 
@@ -8,7 +23,7 @@ typedef uint32_t int_lcp;
 typedef uint8_t int8;
 typedef uint8_t dataTypelenSeq;	//length of the sequences (in biologic case 100)
 typedef uint32_t dataTypeNSeq;	//number of sequences
-typedef __int128 uint128_t;
+typedef unsigned __int128 uint128_t;
 
 typedef pair<uint64_t,uint32_t> coordinate;//suffix array coordinate (text, suff)
 
@@ -27,194 +42,1644 @@ typedef struct{
 } t_GSA;
 
 /*
- * this class abstracts the EGSA type and allows reading from different formats (EGSA/BCR)
+ * a file of the index, opened read-only. It is either memory-mapped (records are decoded
+ * straight out of the mapped pages) or read explicitly with pread (read-ahead mode). Pipes
+ * (path "-" = standard input, or a named pipe) can only be read sequentially (read_next).
+ */
+class index_file{
+
+public:
+
+	index_file(){}
+
+	~index_file(){
+
+		close();
+
+	}
+
+	/*
+	 * open the file. Returns false if the file cannot be opened.
+	 */
+	bool open(string & path){
+
+		close();
+
+		fd = path.compare("-") == 0 ? dup(STDIN_FILENO) : ::open(path.c_str(), O_RDONLY);
+
+		if(fd < 0) return false;
+
+		struct stat st;
+
+		if(fstat(fd, &st) != 0){
+
+			close();
+			return false;
+
+		}
+
+		stream = not S_ISREG(st.st_mode);
+		len = stream ? 0 : st.st_size;
+
+		return true;
+
+	}
+
+	/*
+	 * map the whole file in memory. Returns false if the file cannot be mapped.
+	 */
+	bool map(){
+
+		if(ptr != NULL or len == 0) return true;
+
+		void * p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if(p == MAP_FAILED) return false;
+
+		ptr = (const uint8_t*)p;
+
+		return true;
+
+	}
+
+	/*
+	 * hint the kernel that bytes [from, to) of the mapping will be scanned from left to right:
+	 * pages are prefetched aggressively and dropped soon after they have been read.
+	 */
+	void advise_sequential(uint64_t from = 0, uint64_t to = ~uint64_t(0)){
+
+		if(ptr == NULL) return;
+
+		to = to < len ? to : len;
+
+		uint64_t page = sysconf(_SC_PAGESIZE);
+		from -= from % page;
+
+		if(from >= to) return;
+
+		madvise((void*)(ptr + from), to - from, MADV_SEQUENTIAL);
+		madvise((void*)(ptr + from), to - from, MADV_WILLNEED);
+
+	}
+
+	/*
+	 * read len bytes starting at offset off. Returns false on I/O error or premature end of file.
+	 */
+	bool read_at(uint8_t * out, uint64_t len, uint64_t off){
+
+		while(len > 0){
+
+			ssize_t r = pread(fd, out, len, off);
+
+			if(r < 0 and errno == EINTR) continue;
+			if(r <= 0) return false;
+
+			out += r;
+			off += r;
+			len -= r;
+
+		}
+
+		return true;
+
+	}
+
+	/*
+	 * read the next (at most) len bytes of a pipe. Returns the number of bytes read: less than
+	 * len only at the end of the stream. Sets error to true on I/O error.
+	 */
+	uint64_t read_next(uint8_t * out, uint64_t len, bool & error){
+
+		uint64_t done = 0;
+
+		while(done < len){
+
+			ssize_t r = ::read(fd, out + done, len - done);
+
+			if(r < 0 and errno == EINTR) continue;
+
+			if(r < 0){
+
+				error = true;
+				break;
+
+			}
+
+			if(r == 0) break;
+
+			done += r;
+
+		}
+
+		return done;
+
+	}
+
+	void close(){
+
+		if(ptr != NULL) munmap((void*)ptr, len);
+		if(fd >= 0) ::close(fd);
+
+		ptr = NULL;
+		len = 0;
+		fd = -1;
+		stream = false;
+
+	}
+
+	bool is_open(){
+
+		return fd >= 0;
+
+	}
+
+	/*
+	 * true if the file is a pipe (no random access)
+	 */
+	bool is_stream(){
+
+		return stream;
+
+	}
+
+	const uint8_t * data(){
+
+		return ptr;
+
+	}
+
+	uint64_t size(){
+
+		return len;
+
+	}
+
+private:
+
+	int fd = -1;
+	const uint8_t * ptr = NULL;
+	uint64_t len = 0;
+	bool stream = false;
+
+};
+
+/*
+ * background I/O thread filling a ring of buffers with consecutive blocks of records, so
+ * that reading the next block overlaps with the decoding of the current one. Block b
+ * covers the same records in all files (the BCR index is read in lock-step). A single pipe
+ * is read sequentially from its current position until the end of the stream.
+ */
+class readahead_reader{
+
+public:
+
+	/*
+	 * read records [first, last) of the files. Each file has the given byte size per record.
+	 */
+	readahead_reader(vector<index_file*> files, vector<int> rec_sizes, uint64_t first, uint64_t last, int n_buffers, uint64_t block_size){
+
+		this->files = files;
+		this->rec_sizes = rec_sizes;
+		this->next_rec = first;
+		this->last = last;
+		this->block_size = block_size;
+
+		slots = vector<slot>(n_buffers);
+
+		for(auto & s : slots)
+			for(auto r : rec_sizes)
+				s.data.push_back(vector<uint8_t>(block_size * r));
+
+		io_thread = thread(&readahead_reader::fill, this);
+
+	}
+
+	~readahead_reader(){
+
+		{
+			lock_guard<mutex> lock(m);
+			stop = true;
+		}
+
+		cv.notify_all();
+		io_thread.join();
+
+	}
+
+	/*
+	 * release the current block and wait for the next one. Returns the number of records in the
+	 * block (0 if no records are left); ptrs[f] points to the block's data of the f-th file.
+	 */
+	uint64_t next(vector<const uint8_t*> & ptrs){
+
+		unique_lock<mutex> lock(m);
+
+		if(current >= 0){
+
+			slots[current].ready = false;
+			current = (current + 1) % slots.size();
+			cv.notify_all();
+
+		}else{
+
+			current = 0;
+
+		}
+
+		auto t0 = chrono::steady_clock::now();
+
+		cv.wait(lock, [&]{ return slots[current].ready or done; });
+
+		wait_time += chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+
+		if(not slots[current].ready){
+
+			if(error){
+
+				cout << "Error: could not read index files." << endl;
+				exit(1);
+
+			}
+
+			return 0;
+
+		}
+
+		ptrs.resize(files.size());
+		for(uint64_t f = 0; f < files.size(); ++f) ptrs[f] = slots[current].data[f].data();
+
+		return slots[current].count;
+
+	}
+
+	/*
+	 * seconds spent by the consumer waiting for data
+	 */
+	double io_wait(){
+
+		return wait_time;
+
+	}
+
+private:
+
+	struct slot{
+
+		vector<vector<uint8_t> > data;//one buffer per file
+		uint64_t count = 0;//number of records in the block
+		bool ready = false;
+
+	};
+
+	void fill(){
+
+		uint64_t s = 0;//slot to be filled
+
+		while(true){
+
+			{
+				unique_lock<mutex> lock(m);
+				cv.wait(lock, [&]{ return (not slots[s].ready) or stop; });
+
+				if(stop or next_rec >= last){
+
+					done = true;
+					cv.notify_all();
+					return;
+
+				}
+
+			}
+
+			uint64_t count = last - next_rec < block_size ? last - next_rec : block_size;
+			bool ok = true;
+
+			if(files[0]->is_stream()){
+
+				bool err = false;
+				uint64_t bytes = files[0]->read_next(slots[s].data[0].data(), count * rec_sizes[0], err);
+
+				//a record truncated by the end of the stream is an error too
+				ok = not err and bytes % rec_sizes[0] == 0;
+				count = bytes / rec_sizes[0];
+
+			}else{
+
+				for(uint64_t f = 0; f < files.size(); ++f)
+					ok = ok and files[f]->read_at(slots[s].data[f].data(), count * rec_sizes[f], next_rec * rec_sizes[f]);
+
+			}
+
+			{
+				lock_guard<mutex> lock(m);
+
+				if(not ok){
+
+					error = true;
+					done = true;
+					cv.notify_all();
+					return;
+
+				}
+
+				//end of the stream
+				if(count == 0){
+
+					done = true;
+					cv.notify_all();
+					return;
+
+				}
+
+				slots[s].count = count;
+				slots[s].ready = true;
+				next_rec += count;
+
+			}
+
+			cv.notify_all();
+			s = (s + 1) % slots.size();
+
+		}
+
+	}
+
+	vector<index_file*> files;
+	vector<int> rec_sizes;
+
+	uint64_t next_rec;//next record to be read by the I/O thread
+	uint64_t last;
+	uint64_t block_size;//records per block
+
+	vector<slot> slots;
+	int64_t current = -1;//slot being decoded by the consumer
+
+	mutex m;
+	condition_variable cv;
+	thread io_thread;
+
+	bool stop = false;
+	bool done = false;
+	bool error = false;
+
+	double wait_time = 0;
+
+};
+
+/*
+ * decode a little-endian unsigned integer of the given byte size
+ */
+inline uint64_t load_int(const uint8_t * p, int size){
+
+	switch(size){
+
+		case 1 : return *p; break;
+		case 2 : uint16_t x16; memcpy(&x16, p, 2); return x16; break;
+		case 4 : uint32_t x32; memcpy(&x32, p, 4); return x32; break;
+		case 8 : uint64_t x64; memcpy(&x64, p, 8); return x64; break;
+
+	}
+
+	return 0;
+
+}
+
+/*
+ * same as above, with the byte size fixed at compile time
+ */
+template<int size> inline uint64_t load_int(const uint8_t * p);
+
+template<> inline uint64_t load_int<1>(const uint8_t * p){ return *p; }
+template<> inline uint64_t load_int<2>(const uint8_t * p){ uint16_t x; memcpy(&x, p, 2); return x; }
+template<> inline uint64_t load_int<4>(const uint8_t * p){ uint32_t x; memcpy(&x, p, 4); return x; }
+template<> inline uint64_t load_int<8>(const uint8_t * p){ uint64_t x; memcpy(&x, p, 8); return x; }
+
+/*
+ * columns of the EGSA. A reader declares the columns it needs as a bitwise OR of these values
+ * (see egsa_stream): the others are not read and are returned as 0.
+ */
+enum egsa_column{
+
+	col_text = 1,
+	col_suff = 2,
+	col_lcp = 4,
+	col_bwt = 8,
+	col_all = 15
+
+};
+
+/*
+ * raw index data (mapped or buffered) and byte sizes of its components, as seen by the record decoders
+ */
+struct index_layout{
+
+	const uint8_t * egsa; //EGSA records: text, suff, lcp, bwt
+
+	const uint8_t * lcp; //BCR LCP
+	const uint8_t * bwt; //BCR BWT
+	const uint8_t * gsa; //BCR pairs: suff, text
+
+	int lcp_size;
+	int da_size;
+	int suff_size;
+
+	int columns; //columns to be decoded (see egsa_column)
+
+};
+
+/*
+ * caller-owned column arrays. Columns with a NULL pointer are not decoded.
+ */
+struct egsa_columns{
+
+	int_text * text;
+	int_suff * suff;
+	int_lcp * lcp;
+	int8 * bwt;
+
+};
+
+/*
+ * decode n consecutive records starting from record i, either as t_GSA entries or as columns
+ */
+typedef void (*decoder_t)(const index_layout & L, uint64_t i, uint64_t n, t_GSA * out);
+typedef void (*column_decoder_t)(const index_layout & L, uint64_t i, uint64_t n, const egsa_columns & C);
+
+/*
+ * record decoders specialized on the byte sizes of (LCP, DA, suff): the per-record loop has
+ * no branches and its loads have constant width.
+ */
+template<int lcp_size, int da_size, int suff_size>
+struct record_decoder{
+
+	static void egsa(const index_layout & L, uint64_t i, uint64_t n, t_GSA * out){
+
+		if(L.columns != col_all){
+
+			projected(L, i, n, out, true);
+			return;
+
+		}
+
+		const int rec_size = da_size + suff_size + lcp_size + 1;
+		const uint8_t * p = L.egsa + i * rec_size;
+
+		for(uint64_t j = 0; j < n; ++j){
+
+			out[j].text = load_int<da_size>(p);
+			out[j].suff = load_int<suff_size>(p + da_size);
+			out[j].lcp = load_int<lcp_size>(p + da_size + suff_size);
+			out[j].bwt = p[da_size + suff_size + lcp_size];
+
+			p += rec_size;
+
+		}
+
+	}
+
+	static void bcr(const index_layout & L, uint64_t i, uint64_t n, t_GSA * out){
+
+		if(L.columns != col_all){
+
+			projected(L, i, n, out, false);
+			return;
+
+		}
+
+		const int pair_size = suff_size + da_size;
+		const uint8_t * g = L.gsa + i * pair_size;
+		const uint8_t * l = L.lcp + i * lcp_size;
+		const uint8_t * b = L.bwt + i;
+
+		for(uint64_t j = 0; j < n; ++j){
+
+			out[j].suff = load_int<suff_size>(g);
+			out[j].text = load_int<da_size>(g + suff_size);
+			out[j].lcp = load_int<lcp_size>(l);
+			out[j].bwt = b[j];
+
+			g += pair_size;
+			l += lcp_size;
+
+		}
+
+	}
+
+	/*
+	 * only some columns are needed: one strided pass per column, the others are set to 0
+	 */
+	static void projected(const index_layout & L, uint64_t i, uint64_t n, t_GSA * out, bool egsa){
+
+		for(uint64_t j = 0; j < n; ++j) out[j] = {0,0,0,0};
+
+		if(egsa){
+
+			const int rec_size = da_size + suff_size + lcp_size + 1;
+			const uint8_t * p = L.egsa + i * rec_size;
+
+			if(L.columns & col_text)
+				for(uint64_t j = 0; j < n; ++j) out[j].text = load_int<da_size>(p + j * rec_size);
+
+			if(L.columns & col_suff)
+				for(uint64_t j = 0; j < n; ++j) out[j].suff = load_int<suff_size>(p + j * rec_size + da_size);
+
+			if(L.columns & col_lcp)
+				for(uint64_t j = 0; j < n; ++j) out[j].lcp = load_int<lcp_size>(p + j * rec_size + da_size + suff_size);
+
+			if(L.columns & col_bwt)
+				for(uint64_t j = 0; j < n; ++j) out[j].bwt = p[j * rec_size + da_size + suff_size + lcp_size];
+
+			return;
+
+		}
+
+		const int pair_size = suff_size + da_size;
+
+		if(L.columns & col_text)
+			for(uint64_t j = 0; j < n; ++j) out[j].text = load_int<da_size>(L.gsa + (i + j) * pair_size + suff_size);
+
+		if(L.columns & col_suff)
+			for(uint64_t j = 0; j < n; ++j) out[j].suff = load_int<suff_size>(L.gsa + (i + j) * pair_size);
+
+		if(L.columns & col_lcp)
+			for(uint64_t j = 0; j < n; ++j) out[j].lcp = load_int<lcp_size>(L.lcp + (i + j) * lcp_size);
+
+		if(L.columns & col_bwt)
+			for(uint64_t j = 0; j < n; ++j) out[j].bwt = L.bwt[i + j];
+
+	}
+
+	/*
+	 * one tight loop per requested column
+	 */
+	static void egsa_to_columns(const index_layout & L, uint64_t i, uint64_t n, const egsa_columns & C){
+
+		const int rec_size = da_size + suff_size + lcp_size + 1;
+		const uint8_t * p = L.egsa + i * rec_size;
+
+		if(C.text != NULL)
+			for(uint64_t j = 0; j < n; ++j) C.text[j] = load_int<da_size>(p + j * rec_size);
+
+		if(C.suff != NULL)
+			for(uint64_t j = 0; j < n; ++j) C.suff[j] = load_int<suff_size>(p + j * rec_size + da_size);
+
+		if(C.lcp != NULL)
+			for(uint64_t j = 0; j < n; ++j) C.lcp[j] = load_int<lcp_size>(p + j * rec_size + da_size + suff_size);
+
+		if(C.bwt != NULL)
+			for(uint64_t j = 0; j < n; ++j) C.bwt[j] = p[j * rec_size + da_size + suff_size + lcp_size];
+
+	}
+
+	static void bcr_to_columns(const index_layout & L, uint64_t i, uint64_t n, const egsa_columns & C){
+
+		const int pair_size = suff_size + da_size;
+		const uint8_t * g = L.gsa + i * pair_size;
+
+		if(C.text != NULL)
+			for(uint64_t j = 0; j < n; ++j) C.text[j] = load_int<da_size>(g + j * pair_size + suff_size);
+
+		if(C.suff != NULL)
+			for(uint64_t j = 0; j < n; ++j) C.suff[j] = load_int<suff_size>(g + j * pair_size);
+
+		if(C.lcp != NULL)
+			for(uint64_t j = 0; j < n; ++j) C.lcp[j] = load_int<lcp_size>(L.lcp + (i + j) * lcp_size);
+
+		if(C.bwt != NULL)
+			memcpy(C.bwt, L.bwt + i, n);
+
+	}
+
+};
+
+/*
+ * fallback for byte-size combinations without a specialized decoder
+ */
+struct generic_decoder{
+
+	static void egsa(const index_layout & L, uint64_t i, uint64_t n, t_GSA * out){
+
+		const int rec_size = L.da_size + L.suff_size + L.lcp_size + 1;
+		const uint8_t * p = L.egsa + i * rec_size;
+
+		for(uint64_t j = 0; j < n; ++j){
+
+			out[j] = {0,0,0,0};
+
+			if(L.columns & col_text) out[j].text = load_int(p, L.da_size);
+			if(L.columns & col_suff) out[j].suff = load_int(p + L.da_size, L.suff_size);
+			if(L.columns & col_lcp) out[j].lcp = load_int(p + L.da_size + L.suff_size, L.lcp_size);
+			if(L.columns & col_bwt) out[j].bwt = p[L.da_size + L.suff_size + L.lcp_size];
+
+			p += rec_size;
+
+		}
+
+	}
+
+	static void bcr(const index_layout & L, uint64_t i, uint64_t n, t_GSA * out){
+
+		const int pair_size = L.suff_size + L.da_size;
+
+		for(uint64_t j = 0; j < n; ++j){
+
+			out[j] = {0,0,0,0};
+
+			if(L.columns & col_suff) out[j].suff = load_int(L.gsa + (i+j) * pair_size, L.suff_size);
+			if(L.columns & col_text) out[j].text = load_int(L.gsa + (i+j) * pair_size + L.suff_size, L.da_size);
+			if(L.columns & col_lcp) out[j].lcp = load_int(L.lcp + (i+j) * L.lcp_size, L.lcp_size);
+			if(L.columns & col_bwt) out[j].bwt = L.bwt[i+j];
+
+		}
+
+	}
+
+	static void egsa_to_columns(const index_layout & L, uint64_t i, uint64_t n, const egsa_columns & C){
+
+		const int rec_size = L.da_size + L.suff_size + L.lcp_size + 1;
+		const uint8_t * p = L.egsa + i * rec_size;
+
+		for(uint64_t j = 0; j < n; ++j){
+
+			if(C.text != NULL) C.text[j] = load_int(p, L.da_size);
+			if(C.suff != NULL) C.suff[j] = load_int(p + L.da_size, L.suff_size);
+			if(C.lcp != NULL) C.lcp[j] = load_int(p + L.da_size + L.suff_size, L.lcp_size);
+			if(C.bwt != NULL) C.bwt[j] = p[L.da_size + L.suff_size + L.lcp_size];
+
+			p += rec_size;
+
+		}
+
+	}
+
+	static void bcr_to_columns(const index_layout & L, uint64_t i, uint64_t n, const egsa_columns & C){
+
+		const int pair_size = L.suff_size + L.da_size;
+
+		for(uint64_t j = 0; j < n; ++j){
+
+			if(C.suff != NULL) C.suff[j] = load_int(L.gsa + (i+j) * pair_size, L.suff_size);
+			if(C.text != NULL) C.text[j] = load_int(L.gsa + (i+j) * pair_size + L.suff_size, L.da_size);
+			if(C.lcp != NULL) C.lcp[j] = load_int(L.lcp + (i+j) * L.lcp_size, L.lcp_size);
+			if(C.bwt != NULL) C.bwt[j] = L.bwt[i+j];
+
+		}
+
+	}
+
+};
+
+/*
+ * size and modification time of the EGSA (reads.fasta.gesa) or, if missing, BCR index of the input
+ * fasta file: stored in the header of reads.fasta.egsa2 to detect a compressed index that does not
+ * match them. Returns false if there is no such index.
+ */
+bool index_stamp(string & input_path, uint64_t & size, int64_t & mtime){
+
+	size = 0;
+	mtime = 0;
+
+	struct stat st;
+
+	if(stat((input_path + ".gesa").c_str(), &st) == 0 and S_ISREG(st.st_mode)){
+
+		size = st.st_size;
+		mtime = st.st_mtime;
+
+		return true;
+
+	}
+
+	for(string ext : {".out", ".out.lcp", ".out.pairSA"}){
+
+		if(stat((input_path + ext).c_str(), &st) != 0 or not S_ISREG(st.st_mode)){
+
+			size = 0;
+			mtime = 0;
+
+			return false;
+
+		}
+
+		size += st.st_size;
+		mtime = st.st_mtime > mtime ? st.st_mtime : mtime;
+
+	}
+
+	return true;
+
+}
+
+/*
+ * this class abstracts the EGSA type and allows reading from different formats (EGSA/BCR/egsa2)
+ *
+ * by default the index files are memory-mapped and records are decoded directly from the
+ * mapped pages; with set_readahead() they are instead read by a background I/O thread (EGSA
+ * and BCR only: the compressed egsa2 format is always memory-mapped).
+ *
+ * A reader can declare the columns it needs (projection): BCR files holding only unneeded
+ * columns are never opened, and in EGSA/egsa2 files the unneeded fields are not decoded.
+ * The decoder is chosen once in set_bytesizes() and decodes entries in blocks. Entries can be
+ * read one at a time (read_el), or in blocks of caller-owned entries/columns (read_block,
+ * read_columns). The three methods can be mixed: they all continue from the same position,
+ * which can be moved with seek().
+ *
+ * A stream can be limited to a range [begin, end) of the index (set_range). For parallel
+ * readers, partition() splits the index in balanced ranges and cursor() opens an independent
+ * stream (own files, mapping or read-ahead thread, and buffers) limited to one of them.
+ *
+ * The EGSA can also be read from a pipe (standard input or a named pipe, e.g. straight from the
+ * EGSA builder): the stream is then purely sequential (no seeking backwards, no cursors) and the
+ * number of entries is known only once the end of the stream has been reached.
  */
 class egsa_stream{
 
-public:
+public:
+
+	/*
+	 * input: reads.fasta
+	 *
+	 * automatically detects the index files and format. The compressed index (reads.fasta.egsa2)
+	 * is used if present, unless it does not match the EGSA/BCR index next to it (it was then
+	 * converted from an older index). If input_path is "-" (standard input) or a named pipe, the
+	 * EGSA records are read from it.
+	 *
+	 * columns: bitwise OR of the columns (egsa_column) to be read. The others are returned as 0.
+	 * use_egsa2: if false, reads.fasta.egsa2 is ignored.
+	 *
+	 */
+	egsa_stream(string & input_path, int columns = col_all, bool use_egsa2 = true){
+
+		this->input_path = input_path;
+		this->columns = columns;
+		L.columns = columns;
+
+		string egsa2_path = input_path;
+		egsa2_path.append(".egsa2");
+
+		string egsa_path = input_path;
+		egsa_path.append(".gesa");
+
+		struct stat st;
+
+		if(input_path.compare("-") == 0 or (stat(input_path.c_str(), &st) == 0 and S_ISFIFO(st.st_mode))){
+
+			if(not EGSA.open(input_path)){
+
+				cout << "Error: could not open " << input_path << endl;
+				exit(1);
+
+			}
+
+			//standard input can also be redirected from a regular file
+			egsa = true;
+			pipe = EGSA.is_stream();
+
+		}else if(use_egsa2 and open_egsa2(egsa2_path)){
+
+			egsa2 = true;
+
+		}else if(EGSA.open(egsa_path)){
+
+			egsa = true;
+			pipe = EGSA.is_stream();
+
+		}else{//else try BCR
+
+			string LCP_path = input_path;
+			LCP_path.append(".out.lcp");
+
+			string BWT_path = input_path;
+			BWT_path.append(".out");
+
+			string GSA_path = input_path;
+			GSA_path.append(".out.pairSA");
+
+			//open only the files containing the needed columns
+			bool need_lcp = columns & col_lcp;
+			bool need_bwt = columns & col_bwt;
+			bool need_gsa = columns & (col_text | col_suff);
+
+			if(	(need_lcp or need_bwt or need_gsa) and
+				(not need_lcp or LCP.open(LCP_path)) and
+				(not need_bwt or BWT.open(BWT_path)) and
+				(not need_gsa or GSA.open(GSA_path))){
+
+				bcr = true;
+
+			}else{
+
+				cout << "Error: missing index files." << endl;
+				exit(1);
+
+			}
+
+		}
+
+		buf = vector<t_GSA>(block_size);
+
+		set_bytesizes(lcp_size, da_size, suff_size);
+
+	}
+
+	/*
+	 * returns true iff index files exist in the input folder
+	 */
+	bool index_exists(){
+
+		return egsa or bcr or egsa2;
+
+	}
+
+	/*
+	 * true if the EGSA is read from a pipe (sequential access only)
+	 */
+	bool is_pipe(){
+
+		return pipe;
+
+	}
+
+	/*
+	 * as with ifstream, eof() becomes true only after an attempt to read past the last entry.
+	 */
+	bool eof(){
+
+		if(index_exists()){
+
+			return end;
+
+		}
+
+		cout << "Error: missing index files." << endl;
+		exit(1);
+
+	}
+
+	/*
+	 * overwrite default type byte-sizes (LCP, document array, suffix in read)
+	 */
+	void set_bytesizes(int lcp_size, int da_size, int suff_size){
+
+		if(not valid_size(lcp_size) or not valid_size(da_size) or not valid_size(suff_size)){
+
+			cout << "Error: byte sizes of LCP/DA/pos must be 1, 2, 4, or 8." << endl;
+			exit(1);
+
+		}
+
+		this->lcp_size = lcp_size;
+		this->da_size = da_size;
+		this->suff_size = suff_size;
+
+		L.lcp_size = lcp_size;
+		L.da_size = da_size;
+		L.suff_size = suff_size;
+
+		//number of entries in the index
+		if(pipe){
+
+			n = ~uint64_t(0);//unknown until the end of the stream
+
+		}else if(egsa){
+
+			n = EGSA.size() / (da_size + suff_size + lcp_size + 1);
+
+		}else if(bcr){
+
+			n = 	LCP.is_open() ? LCP.size() / lcp_size :
+					BWT.is_open() ? BWT.size() :
+					GSA.size() / (suff_size + da_size);
+
+		}else if(egsa2){
+
+			n = H2.n;
+
+		}
+
+		last = range_end < n ? range_end : n;
+
+		select_decoder();
+
+	}
+
+	/*
+	 * number of entries in the index. When reading from a pipe, this is 2^64-1 until the end of
+	 * the stream has been reached.
+	 */
+	uint64_t size(){
+
+		return n;
+
+	}
+
+	/*
+	 * the next entry read will be entry number j (0-based) of the index. O(1) for EGSA and BCR
+	 * files, for egsa2 files the block containing j is found through the block directory. In
+	 * read-ahead mode, seeking backwards or beyond the blocks being prefetched restarts the I/O
+	 * thread from j. j is clamped to the range set with set_range(). Pipes can only skip forward.
+	 */
+	void seek(uint64_t j){
+
+		j = j < last ? j : last;
+		j = j > range_begin ? j : range_begin;
+
+		end = false;
+
+		//entry j has already been decoded in the read_el buffer, which holds entries [i - buf_len, i)
+		if(j + buf_len >= i and j <= i){
+
+			buf_pos = buf_len - (i - j);
+			return;
+
+		}
+
+		if(pipe and j < block_start){
+
+			cout << "Error: cannot seek backwards in an EGSA read from a pipe." << endl;
+			exit(1);
+
+		}
+
+		buf_pos = buf_len = 0;
+
+		if(RA != NULL and not pipe and (j < block_start or j >= block_end + readahead_buffers * readahead_block)){
+
+			RA.reset();
+			RA = unique_ptr<readahead_reader>(new readahead_reader(RA_files, RA_rec_sizes, j, last, readahead_buffers, readahead_block));
+			block_start = block_end = j;
+
+		}
+
+		i = j;
+
+	}
+
+	/*
+	 * limit the stream to entries [begin, end) of the index and move to entry begin: reads stop
+	 * (eof) at entry end. Entries outside the range are never read, nor prefetched.
+	 */
+	void set_range(uint64_t begin, uint64_t end){
+
+		range_begin = begin < n ? begin : n;
+		range_end = end > range_begin ? end : range_begin;
+		last = range_end < n ? range_end : n;
+
+		seek(range_begin);
+
+	}
+
+	/*
+	 * split the range of the stream (by default, the whole index) in N balanced ranges
+	 * [begin, end) of consecutive entries. For egsa2 files the boundaries are aligned to the
+	 * compressed blocks, so that no block is decoded by two readers. Empty ranges are dropped.
+	 */
+	vector<pair<uint64_t,uint64_t> > partition(uint64_t N){
+
+		no_pipe("partition");
+
+		vector<pair<uint64_t,uint64_t> > ranges;
+
+		N = N == 0 ? 1 : N;
+
+		uint64_t m = last - range_begin;
+		uint64_t begin = range_begin;
+
+		for(uint64_t k = 1; k <= N; ++k){
+
+			uint64_t end = k == N ? last : range_begin + (m / N) * k + (m % N) * k / N;
+
+			if(egsa2 and k < N) end -= end % H2.block_size;
+
+			if(end > begin){
+
+				ranges.push_back({begin, end});
+				begin = end;
+
+			}
+
+		}
+
+		return ranges;
+
+	}
+
+	/*
+	 * open an independent stream over entries [begin, end) of the same index, with the same
+	 * columns, byte sizes, and read-ahead mode as this one. Cursors do not share any state
+	 * and can be used concurrently from different threads.
+	 */
+	unique_ptr<egsa_stream> cursor(uint64_t begin, uint64_t end){
+
+		no_pipe("cursor");
+
+		unique_ptr<egsa_stream> C(new egsa_stream(input_path, columns, egsa2));
+
+		C->set_bytesizes(lcp_size, da_size, suff_size);
+		if(readahead_buffers > 0) C->set_readahead(readahead_buffers);
+		C->set_range(begin, end);
+
+		return C;
+
+	}
+
+	/*
+	 * range [begin, end) of the entries processed by shard i (1 <= i <= N) of a run split over N
+	 * processes: the index is split in N balanced ranges. If k > 0, each boundary is then moved
+	 * forward to the first entry (from entry 2 on) with LCP < k: no cluster computed with
+	 * threshold k crosses it (see internal/lcp_clusters.hpp), and the clusters of the shards are
+	 * exactly those of a run on the whole index. Shards can be empty.
+	 */
+	pair<uint64_t,uint64_t> shard(uint64_t i, uint64_t N, uint32_t k = 0){
+
+		no_pipe("sharding");
+
+		auto boundary = [&](uint64_t j){
+
+			uint64_t b = j == N ? n : (n / N) * j + (n % N) * j / N;
+
+			if(k == 0 or b == 0 or b == n) return b;
+
+			b = b < 2 ? 2 : b;
+
+			auto C = cursor(b, n);
+
+			const uint64_t block_size = 1<<16;
+			auto L = vector<int_lcp>(block_size);
+
+			uint64_t len;
+
+			while((len = C->read_columns(NULL, NULL, L.data(), NULL, block_size)) > 0){
+
+				for(uint64_t t = 0; t < len; ++t) if(L[t] < k) return b + t;
+
+				b += len;
+
+			}
+
+			return n;
+
+		};
+
+		return {boundary(i-1), boundary(i)};
+
+	}
+
+	/*
+	 * read the index with a background I/O thread filling n_buffers (2 = double buffering,
+	 * 3 = triple buffering) blocks ahead of the decoder, instead of memory-mapping it. Must be
+	 * called before the first read.
+	 */
+	void set_readahead(int n_buffers){
+
+		readahead_buffers = n_buffers < 2 ? 2 : n_buffers;
+
+	}
+
+	/*
+	 * print how the time since the first read splits between waiting for I/O and the rest
+	 * (decoding and the caller's computation). Only available in read-ahead mode.
+	 */
+	void print_io_stats(){
+
+		if(RA == NULL) return;
+
+		double total = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+		double wait = RA->io_wait();
+
+		cout << "Index read-ahead: " << wait << " s waiting for I/O, " << (total - wait) << " s computing (" <<
+				(total > 0 ? (100*wait)/total : 0) << "% of time waiting for I/O)." << endl;
+
+	}
+
+	/*
+	 * reading past the last entry returns an entry with all fields set to 0 and turns on eof()
+	 */
+	t_GSA read_el(){
+
+		if(buf_pos == buf_len){
+
+			buf_len = decode_entries(buf.data(), NULL, block_size);
+			buf_pos = 0;
+
+			if(buf_len == 0){
+
+				end = true;
+				return {0,0,0,0};
+
+			}
+
+			end = false;
+
+		}
+
+		return buf[buf_pos++];
+
+	}
+
+	/*
+	 * read up to max entries into out. Returns the number of entries read: if this is smaller
+	 * than max, the end of the index has been reached and eof() is true.
+	 */
+	uint64_t read_block(t_GSA * out, uint64_t max){
+
+		uint64_t m = buffered(max);
+
+		for(uint64_t j = 0; j < m; ++j) out[j] = buf[buf_pos + j];
+		buf_pos += m;
+
+		if(m == max) return m;
+
+		//entries are decoded past the buffer, which no longer holds the entries preceding i
+		buf_pos = buf_len = 0;
+
+		return m + decode_entries(out + m, NULL, max - m);
+
+	}
+
+	/*
+	 * as read_block, but fills only the columns that are not NULL. The entries of the
+	 * columns are in the same order as in the index.
+	 */
+	uint64_t read_columns(int_text * text, int_suff * suff, int_lcp * lcp, int8 * bwt, uint64_t max){
+
+		uint64_t m = buffered(max);
+
+		for(uint64_t j = 0; j < m; ++j){
+
+			t_GSA & e = buf[buf_pos + j];
+
+			if(text != NULL) text[j] = e.text;
+			if(suff != NULL) suff[j] = e.suff;
+			if(lcp != NULL) lcp[j] = e.lcp;
+			if(bwt != NULL) bwt[j] = e.bwt;
+
+		}
+
+		buf_pos += m;
+
+		if(m == max) return m;
+
+		//entries are decoded past the buffer, which no longer holds the entries preceding i
+		buf_pos = buf_len = 0;
+
+		egsa_columns C = {
+			text == NULL ? NULL : text + m,
+			suff == NULL ? NULL : suff + m,
+			lcp == NULL ? NULL : lcp + m,
+			bwt == NULL ? NULL : bwt + m
+		};
+
+		return m + decode_entries(NULL, &C, max - m);
+
+	}
+
+private:
+
+	/*
+	 * number of entries (at most max) that can be served from the read_el buffer
+	 */
+	uint64_t buffered(uint64_t max){
+
+		return buf_len - buf_pos < max ? buf_len - buf_pos : max;
+
+	}
+
+	/*
+	 * decode up to max entries from the index, either as t_GSA entries (out) or as columns (C).
+	 * Turns on eof() if less than max entries are left.
+	 */
+	uint64_t decode_entries(t_GSA * out, egsa_columns * C, uint64_t max){
+
+		uint64_t done = 0;
+
+		while(done < max){
+
+			uint64_t first;
+			uint64_t count = window(max - done, first);
+
+			if(count == 0) break;
+
+			if(egsa2){
+
+				copy_block(first, count, out == NULL ? NULL : out + done, C, done);
+
+			}else if(out != NULL){
+
+				decode(W, first, count, out + done);
+
+			}else{
+
+				egsa_columns D = {
+					C->text == NULL ? NULL : C->text + done,
+					C->suff == NULL ? NULL : C->suff + done,
+					C->lcp == NULL ? NULL : C->lcp + done,
+					C->bwt == NULL ? NULL : C->bwt + done
+				};
+
+				//requested columns outside the projection are read as 0
+				if(D.text != NULL and not (columns & col_text)){ memset(D.text, 0, count * sizeof(int_text)); D.text = NULL; }
+				if(D.suff != NULL and not (columns & col_suff)){ memset(D.suff, 0, count * sizeof(int_suff)); D.suff = NULL; }
+				if(D.lcp != NULL and not (columns & col_lcp)){ memset(D.lcp, 0, count * sizeof(int_lcp)); D.lcp = NULL; }
+				if(D.bwt != NULL and not (columns & col_bwt)){ memset(D.bwt, 0, count); D.bwt = NULL; }
+
+				decode_columns(W, first, count, D);
+
+			}
+
+			i += count;
+			done += count;
+
+		}
+
+		if(done < max) end = true;
+
+		return done;
+
+	}
 
 	/*
-	 * input: reads.fasta
-	 *
-	 * automatically detects the index files and format
-	 *
+	 * make available to the decoders up to max entries starting from entry i. Returns how many
+	 * entries are available (0 at the end of the index). Entry i is entry number 'first' of
+	 * the data pointed by W.
 	 */
-	egsa_stream(string & input_path){
+	uint64_t window(uint64_t max, uint64_t & first){
 
-		string egsa_path = input_path;
-		egsa_path.append(".gesa");
+		if(not started) start();
 
-		EGSA.open(egsa_path, ios::in | ios::binary);
+		if(i >= last) return 0;
 
-		if(EGSA.is_open()){
+		max = last - i < max ? last - i : max;
 
-			egsa = true;
+		if(egsa2){
 
-		}else{//else try BCR
+			uint64_t b = i / H2.block_size;
 
-			string LCP_path = input_path;
-			LCP_path.append(".out.lcp");
+			if(b != block2){
 
-			string BWT_path = input_path;
-			BWT_path.append(".out");
+				const uint8_t * block_end = E2.data() + (b + 1 < H2.n_blocks ? directory2[b+1] : H2.dir_offset);
+				uint64_t count = b + 1 < H2.n_blocks ? H2.block_size : H2.n - b * H2.block_size;
 
-			string GSA_path = input_path;
-			GSA_path.append(".out.pairSA");
+				if(not B2.decode(E2.data() + directory2[b], block_end, columns & col_text, columns & col_suff, columns & col_lcp, columns & col_bwt) or B2.size() != count){
 
-			LCP.open(LCP_path, ios::in | ios::binary);
-			BWT.open(BWT_path, ios::in | ios::binary);
-			GSA.open(GSA_path, ios::in | ios::binary);
+					cout << "Error: block " << b << " of " << input_path << ".egsa2 is corrupt." << endl;
+					exit(1);
 
-			if(LCP.is_open() and BWT.is_open() and GSA.is_open()){
+				}
 
-				bcr = true;
+				block2 = b;
 
-			}else{
+			}
 
-				cout << "Error: missing index files." << endl;
-				exit(1);
+			first = i - b * H2.block_size;
+			return B2.size() - first < max ? B2.size() - first : max;
+
+		}
+
+		if(RA == NULL){
+
+			first = i;
+			return max;
+
+		}
+
+		//skip to the block containing entry i
+		while(i >= block_end){
+
+			vector<const uint8_t*> ptrs;
+			uint64_t count = RA->next(ptrs);
+
+			if(count == 0){
+
+				//now the size of the piped EGSA is known
+				if(pipe) n = last = block_end;
+
+				return 0;
+
+			}
+
+			for(uint64_t f = 0; f < RA_files.size(); ++f){
+
+				if(RA_files[f] == &EGSA) W.egsa = ptrs[f];
+				if(RA_files[f] == &LCP) W.lcp = ptrs[f];
+				if(RA_files[f] == &BWT) W.bwt = ptrs[f];
+				if(RA_files[f] == &GSA) W.gsa = ptrs[f];
 
 			}
 
+			block_start = block_end;
+			block_end += count;
+
 		}
 
+		first = i - block_start;
+		return block_end - i < max ? block_end - i : max;
+
 	}
 
 	/*
-	 * returns true iff index files exist in the input folder
+	 * copy entries [first, first+count) of the current egsa2 block, either as t_GSA entries (out)
+	 * or to the columns C (starting from their position 'done')
 	 */
-	bool index_exists(){
+	void copy_block(uint64_t first, uint64_t count, t_GSA * out, egsa_columns * C, uint64_t done){
+
+		if(out != NULL){
+
+			for(uint64_t j = 0; j < count; ++j){
+
+				out[j].text = B2.text[first + j];
+				out[j].suff = B2.suff[first + j];
+				out[j].lcp = B2.lcp[first + j];
+				out[j].bwt = B2.bwt[first + j];
+
+			}
+
+			return;
+
+		}
 
-		return egsa or bcr;
+		if(C->text != NULL) memcpy(C->text + done, B2.text.data() + first, count * sizeof(int_text));
+		if(C->suff != NULL) memcpy(C->suff + done, B2.suff.data() + first, count * sizeof(int_suff));
+		if(C->lcp != NULL) memcpy(C->lcp + done, B2.lcp.data() + first, count * sizeof(int_lcp));
+		if(C->bwt != NULL) memcpy(C->bwt + done, B2.bwt.data() + first, count);
 
 	}
 
-	bool eof(){
+	/*
+	 * open the compressed index and read its header and block directory, which are checked against
+	 * the file size. Returns false if it does not exist or if it does not match the EGSA/BCR index.
+	 */
+	bool open_egsa2(string & egsa2_path){
 
-		if(egsa){
+		if(not E2.open(egsa2_path)) return false;
+
+		if(not E2.read_at((uint8_t*)&H2, sizeof(egsa2_header), 0) or memcmp(H2.magic, egsa2_magic, 8) != 0){
+
+			cout << "Error: " << egsa2_path << " is not a valid egsa2 file." << endl;
+			exit(1);
 
-			return EGSA.eof();
+		}
 
-		}else if (bcr){
+		if(H2.version != egsa2_version){
 
-			return LCP.eof();
+			cout << "Error: " << egsa2_path << " was written by a different version of compress_egsa. Remove it and run compress_egsa again." << endl;
+			exit(1);
 
 		}
 
-		cout << "Error: missing index files." << endl;
-		exit(1);
+		uint64_t size = E2.size();
+		uint64_t header = sizeof(egsa2_header);
+
+		bool valid = 	H2.block_size > 0 and
+						H2.n_blocks == H2.n / H2.block_size + (H2.n % H2.block_size != 0) and
+						H2.dir_offset >= header and H2.dir_offset <= size and
+						H2.n_blocks <= (size - H2.dir_offset) / sizeof(uint64_t);
+
+		if(valid){
+
+			directory2 = vector<uint64_t>(H2.n_blocks);
+			valid = E2.read_at((uint8_t*)directory2.data(), H2.n_blocks * sizeof(uint64_t), H2.dir_offset);
+
+		}
+
+		//blocks are stored in order between the header and the directory: [directory2[b], directory2[b+1])
+		for(uint64_t b = 0; valid and b < H2.n_blocks; ++b){
+
+			uint64_t next = b + 1 < H2.n_blocks ? directory2[b+1] : H2.dir_offset;
+			valid = directory2[b] >= header and directory2[b] < next;
+
+		}
+
+		if(not valid){
+
+			cout << "Error: " << egsa2_path << " is truncated or corrupt." << endl;
+			exit(1);
+
+		}
+
+		uint64_t source_size;
+		int64_t source_mtime;
+
+		if(index_stamp(input_path, source_size, source_mtime) and (source_size != H2.source_size or source_mtime != H2.source_mtime)){
+
+			cout << "Warning: " << egsa2_path << " does not match the EGSA/BCR index of " << input_path << ": ignored." << endl;
+
+			E2.close();
+			directory2.clear();
+
+			return false;
+
+		}
+
+		return true;
 
 	}
 
 	/*
-	 * overwrite default type byte-sizes (LCP, document array, suffix in read)
+	 * called at the first read: map the index or start the read-ahead thread
 	 */
-	void set_bytesizes(int lcp_size, int da_size, int suff_size){
+	void start(){
 
-		this->lcp_size = lcp_size;
-		this->da_size = da_size;
-		this->suff_size = suff_size;
+		started = true;
+		start_time = chrono::steady_clock::now();
 
-	}
+		W = L;
 
-	t_GSA read_el(){
+		if(egsa2){
 
-		t_GSA e;
+			if(not E2.map()){
 
-		if(egsa){
+				cout << "Error: could not memory-map index files." << endl;
+				exit(1);
+
+			}
 
-			switch(da_size){
+			if(i < last){
 
-				case 1 : uint8_t x8; EGSA.read((char*)&x8, 1); e.text = x8;  break;
-				case 2 : uint16_t x16; EGSA.read((char*)&x16, 2); e.text = x16; break;
-				case 4 : uint32_t x32; EGSA.read((char*)&x32, 4); e.text = x32; break;
-				case 8 : uint64_t x64; EGSA.read((char*)&x64, 8); e.text = x64; break;
+				uint64_t b_last = (last - 1) / H2.block_size + 1;
+				E2.advise_sequential(directory2[i / H2.block_size], b_last < H2.n_blocks ? directory2[b_last] : H2.dir_offset);
 
 			}
 
-			switch(suff_size){
+			return;
 
-				case 1 : uint8_t x8; EGSA.read((char*)&x8, 1); e.suff = x8;  break;
-				case 2 : uint16_t x16; EGSA.read((char*)&x16, 2); e.suff = x16; break;
-				case 4 : uint32_t x32; EGSA.read((char*)&x32, 4); e.suff = x32; break;
-				case 8 : uint64_t x64; EGSA.read((char*)&x64, 8); e.suff = x64; break;
+		}
 
-			}
+		//pipes are always read by the I/O thread, from their first record
+		if(pipe){
 
-			switch(lcp_size){
+			readahead_buffers = readahead_buffers < 2 ? 2 : readahead_buffers;
 
-				case 1 : uint8_t x8; EGSA.read((char*)&x8, 1); e.lcp = x8;  break;
-				case 2 : uint16_t x16; EGSA.read((char*)&x16, 2); e.lcp = x16; break;
-				case 4 : uint32_t x32; EGSA.read((char*)&x32, 4); e.lcp = x32; break;
-				case 8 : uint64_t x64; EGSA.read((char*)&x64, 8); e.lcp = x64; break;
+			RA_files = {&EGSA};
+			RA_rec_sizes = {da_size + suff_size + lcp_size + 1};
 
-			}
+			RA = unique_ptr<readahead_reader>(new readahead_reader(RA_files, RA_rec_sizes, 0, last, readahead_buffers, readahead_block));
+			block_start = block_end = 0;
 
-			uint8_t x8;
-			EGSA.read((char*)&x8, 1);
-			e.bwt = x8;
+			return;
 
-		}else if(bcr){
+		}
 
-			switch(suff_size){
+		if(readahead_buffers > 0){
 
-				case 1 : uint8_t x8; GSA.read((char*)&x8, 1); e.suff = x8;  break;
-				case 2 : uint16_t x16; GSA.read((char*)&x16, 2); e.suff = x16; break;
-				case 4 : uint32_t x32; GSA.read((char*)&x32, 4); e.suff = x32; break;
-				case 8 : uint64_t x64; GSA.read((char*)&x64, 8); e.suff = x64; break;
+			if(egsa){
 
-			}
+				RA_files = {&EGSA};
+				RA_rec_sizes = {da_size + suff_size + lcp_size + 1};
 
-			switch(da_size){
+			}else{
 
-				case 1 : uint8_t x8; GSA.read((char*)&x8, 1); e.text = x8;  break;
-				case 2 : uint16_t x16; GSA.read((char*)&x16, 2); e.text = x16; break;
-				case 4 : uint32_t x32; GSA.read((char*)&x32, 4); e.text = x32; break;
-				case 8 : uint64_t x64; GSA.read((char*)&x64, 8); e.text = x64; break;
+				//only the BCR files that have been opened (projection)
+				if(LCP.is_open()){ RA_files.push_back(&LCP); RA_rec_sizes.push_back(lcp_size); }
+				if(BWT.is_open()){ RA_files.push_back(&BWT); RA_rec_sizes.push_back(1); }
+				if(GSA.is_open()){ RA_files.push_back(&GSA); RA_rec_sizes.push_back(suff_size + da_size); }
 
 			}
 
-			switch(lcp_size){
+			RA = unique_ptr<readahead_reader>(new readahead_reader(RA_files, RA_rec_sizes, i, last, readahead_buffers, readahead_block));
+			block_start = block_end = i;
+
+			return;
+
+		}
+
+		vector<index_file*> files = {&EGSA, &LCP, &BWT, &GSA};
 
-				case 1 : uint8_t x8; LCP.read((char*)&x8, 1); e.lcp = x8;  break;
-				case 2 : uint16_t x16; LCP.read((char*)&x16, 2); e.lcp = x16; break;
-				case 4 : uint32_t x32; LCP.read((char*)&x32, 4); e.lcp = x32; break;
-				case 8 : uint64_t x64; LCP.read((char*)&x64, 8); e.lcp = x64; break;
+		//bytes per entry in each file
+		vector<uint64_t> rec_sizes = {uint64_t(da_size + suff_size + lcp_size + 1), uint64_t(lcp_size), 1, uint64_t(suff_size + da_size)};
+
+		for(uint64_t f = 0; f < files.size(); ++f){
+
+			if(not files[f]->is_open()) continue;
+
+			if(not files[f]->map()){
+
+				cout << "Error: could not memory-map index files." << endl;
+				exit(1);
 
 			}
 
-			uint8_t x8;
-			BWT.read((char*)&x8, 1);
-			e.bwt = x8;
+			//prefetch only the range of entries to be read
+			files[f]->advise_sequential(i * rec_sizes[f], last * rec_sizes[f]);
 
-		}else{
+		}
+
+		W.egsa = EGSA.data();
+		W.lcp = LCP.data();
+		W.bwt = BWT.data();
+		W.gsa = GSA.data();
 
-			cout << "Error: missing index files." << endl;
+	}
+
+	void no_pipe(string what){
+
+		if(pipe){
+
+			cout << "Error: " << what << " is not available when the EGSA is read from a pipe." << endl;
 			exit(1);
 
 		}
 
-		return e;
+	}
+
+	static bool valid_size(int s){
+
+		return s == 1 or s == 2 or s == 4 or s == 8;
 
 	}
 
-private:
+	template<int lcp_size, int da_size, int suff_size>
+	bool use(){
+
+		if(this->lcp_size != lcp_size or this->da_size != da_size or this->suff_size != suff_size)
+			return false;
+
+		decode = egsa ? 	record_decoder<lcp_size, da_size, suff_size>::egsa :
+							record_decoder<lcp_size, da_size, suff_size>::bcr;
+
+		decode_columns = egsa ? 	record_decoder<lcp_size, da_size, suff_size>::egsa_to_columns :
+									record_decoder<lcp_size, da_size, suff_size>::bcr_to_columns;
+
+		return true;
+
+	}
+
+	/*
+	 * pick the specialized decoder for the current byte sizes (LCP/DA/pos), if there is one
+	 */
+	void select_decoder(){
+
+		if(	use<1,4,1>() or use<2,4,1>() or use<4,4,1>() or
+			use<1,4,2>() or use<2,4,2>() or use<4,4,2>() or
+			use<1,4,4>() or use<2,4,4>() or use<4,4,4>() or
+			use<1,8,1>() or use<2,8,2>() or use<8,8,8>()) return;
+
+		decode = egsa ? generic_decoder::egsa : generic_decoder::bcr;
+		decode_columns = egsa ? generic_decoder::egsa_to_columns : generic_decoder::bcr_to_columns;
+
+	}
 
 	bool egsa = false;
 	bool bcr = false;
+	bool egsa2 = false;
+	bool pipe = false; //EGSA read from a pipe (sequential access only)
+
+	int columns = col_all; //columns to be read (projection)
 
 	//byte size of components
 	int lcp_size = 1; //LCP values
 	int da_size = 4; //document array (read number)
 	int suff_size = 1; //position inside read
 
+	string input_path;
+
+	uint64_t n = 0; //number of entries in the index
+	uint64_t i = 0; //next entry to be decoded
+
+	//range of entries [range_begin, range_end) to be read (set_range). last = min(range_end, n)
+	uint64_t range_begin = 0;
+	uint64_t range_end = ~uint64_t(0);
+	uint64_t last = 0;
+
+	bool end = false; //true after an attempt to read past the last entry
+	bool started = false; //true after the first read
+
+	index_layout L = {}; //byte sizes of the components
+	index_layout W = {}; //data window currently visible to the decoders
+	decoder_t decode = NULL;
+	column_decoder_t decode_columns = NULL;
+
+	//decoded entries not yet returned by read_el
+	static const uint64_t block_size = 4096;
+	vector<t_GSA> buf;
+	uint64_t buf_pos = 0;
+	uint64_t buf_len = 0;
+
 	//the EGSA index
-	ifstream EGSA;
+	index_file EGSA;
 
 	//the BCR index
-	ifstream LCP;
-	ifstream BWT;
-	ifstream GSA;//pairs
+	index_file LCP;
+	index_file BWT;
+	index_file GSA;//pairs
+
+	//the compressed index and its currently decoded block
+	index_file E2;
+	egsa2_header H2 = {};
+	vector<uint64_t> directory2;
+	egsa2_block B2;
+	uint64_t block2 = ~uint64_t(0);
+
+	//read-ahead mode (declared after the files: the I/O thread stops before they are closed).
+	//Entries [block_start, block_end) are in the current block
+	int readahead_buffers = 0;
+	static const uint64_t readahead_block = 1<<20;
+	unique_ptr<readahead_reader> RA;
+	vector<index_file*> RA_files;
+	vector<int> RA_rec_sizes;
+	uint64_t block_start = 0;
+	uint64_t block_end = 0;
+	chrono::steady_clock::time_point start_time;
 
 };
 
@@ -337,11 +1802,21 @@ public:
 
 	cons(int size){
 
-		counts = vector<vector<int>>(size,vector<int>(4,0));
+		counts = vector<int>(4*size,0);
 		C = string(size,'A');
 
 	}
 
+	/*
+	 * reset to the consensus of no strings, reusing the memory
+	 */
+	void clear(){
+
+		std::fill(counts.begin(), counts.end(), 0);
+		std::fill(C.begin(), C.end(), 'A');
+
+	}
+
 	unsigned char operator[](int i){
 		return C[i];
 	}
@@ -350,9 +1825,9 @@ public:
 
 		int b_i = base_to_int(b);
 
-		counts[i][b_i]++;
+		counts[4*i + b_i]++;
 
-		if( counts[i][b_i] > counts[i][ base_to_int(C[i]) ])
+		if( counts[4*i + b_i] > counts[4*i + base_to_int(C[i])])
 			C[i] = b;
 
 	}
@@ -366,7 +1841,175 @@ public:
 private:
 
 	string C;//the current consensus
-	vector<vector<int>> counts;//base counts
+	vector<int> counts;//base counts (4 per position)
+
+};
+
+/*
+ * pack s in w, 2 bits per base as in packed_cons. Returns false if s is longer than 64 bases or contains
+ * characters other than A,C,G,T.
+ */
+inline bool pack_bases(string & s, uint128_t & w){
+
+	if(s.length() > 64) return false;
+
+	uint64_t half[2] = {0,0};//bases [0,32) and [32,64)
+	bool valid = true;
+
+	for(uint64_t i = 0; i < s.length(); ++i){
+
+		//without branches: ((c>>1) ^ (c>>2)) & 3 is 0,1,2,3 on A,C,G,T
+		unsigned char c = s[i];
+		uint64_t x = ((c >> 1) ^ (c >> 2)) & 3;
+
+		valid &= c == "ACGT"[x];
+		half[i/32] |= x << (2*(i%32));
+
+	}
+
+	w = (uint128_t(half[1]) << 64) | half[0];
+
+	return valid;
+
+}
+
+/*
+ * the same consensus of cons, on strings of length size <= 64 over A,C,G,T packed in uint128_t words
+ * (2 bits per base: A=0, C=1, G=2, T=3, the base at position i in bits 2i and 2i+1). The counts of
+ * each base are bit-sliced: bit 2i of the j-th word of a base is the j-th bit of its count at
+ * position i, so all positions are updated with a few word operations per string.
+ */
+class packed_cons{
+
+public:
+
+	/*
+	 * consensus of at most n_max strings of length size
+	 */
+	packed_cons(int size, uint64_t n_max){
+
+		this->size = size;
+
+		for(int i = 0; i < size; ++i) LOW |= uint128_t(1) << (2*i);
+
+		while((uint64_t(1) << B) <= n_max) B++;
+
+		counts = vector<uint128_t>(4*B, 0);
+
+	}
+
+	void clear(){
+
+		std::fill(counts.begin(), counts.end(), 0);
+		C = 0;
+
+	}
+
+	/*
+	 * add a string to the set. As in cons, the consensus base of a position changes only when the
+	 * count of the new base exceeds the count of the consensus base.
+	 */
+	void add(uint128_t w){
+
+		uint128_t in_w[4];//positions where w has base x
+		uint128_t in_C[4];//positions where the consensus has base x
+
+		for(int x = 0; x < 4; ++x){
+
+			in_w[x] = LOW & ~differ(w, pattern(x));
+			in_C[x] = LOW & ~differ(C, pattern(x));
+
+		}
+
+		//positions where the count of the base of w equals the count of the consensus base
+		uint128_t diff = 0;
+
+		for(int j = 0; j < B; ++j){
+
+			uint128_t cw = 0;
+			uint128_t cc = 0;
+
+			for(int x = 0; x < 4; ++x){
+
+				cw |= counts[4*j + x] & in_w[x];
+				cc |= counts[4*j + x] & in_C[x];
+
+			}
+
+			diff |= cw ^ cc;
+
+		}
+
+		//the count of the base of w will exceed the count of the consensus base
+		uint128_t change = differ(w, C) & ~diff;
+
+		//increment the counts of the bases of w
+		for(int x = 0; x < 4; ++x){
+
+			uint128_t carry = in_w[x];
+
+			for(int j = 0; j < B and carry != 0; ++j){
+
+				uint128_t t = counts[4*j + x] & carry;
+				counts[4*j + x] ^= carry;
+				carry = t;
+
+			}
+
+		}
+
+		change |= change << 1;
+		C = (C & ~change) | (w & change);
+
+	}
+
+	/*
+	 * Hamming distance between the consensus and w
+	 */
+	int distance(uint128_t w){
+
+		return popcount128(differ(w, C));
+
+	}
+
+	string to_string(){
+
+		string s(size, 'A');
+
+		for(int i = 0; i < size; ++i) s[i] = int_to_base(int(C >> (2*i)) & 3);
+
+		return s;
+
+	}
+
+private:
+
+	/*
+	 * positions (bit 2i for position i) where a and b have different bases
+	 */
+	uint128_t differ(uint128_t a, uint128_t b){
+
+		uint128_t x = a ^ b;
+
+		return (x | (x >> 1)) & LOW;
+
+	}
+
+	/*
+	 * base x at all positions
+	 */
+	uint128_t pattern(int x){
+
+		return (x & 1 ? LOW : 0) | (x & 2 ? LOW << 1 : 0);
+
+	}
+
+	int size;
+	int B = 1;//bits per count
+
+	uint128_t LOW = 0;//bit 2i set for every position i
+	uint128_t C = 0;//the current consensus
+	vector<uint128_t> counts;//bit j of the counts of base x: word 4j + x
 
 };
 
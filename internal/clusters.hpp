@@ -0,0 +1,813 @@
+/*
+ * clusters.hpp
+ *
+ * The clusters file (reads.fasta.clusters) written by ebwt2clust and read by clust2snp. A cluster is
+ * a range [start, start + length) of the EGSA; clusters are sorted and do not overlap.
+ *
+ * Two formats are supported:
+ *
+ * - legacy: one record per cluster, uint64_t start followed by uint16_t length (10 bytes). Lengths
+ *   are truncated to 16 bits.
+ * - version 2: the distance of start from the end of the previous cluster and the length, as
+ *   varints. Every block_size clusters the byte offset of the record and the end of the previous
+ *   cluster are stored in a sparse index, which allows seeking by cluster number or EGSA position.
+ *
+ *   File layout:
+ *
+ *   header | records | index (one clusters_block per block of block_size clusters)
+ *
+ * The reader detects the format automatically.
+ *
+ * The writer also saves the histogram of the cluster lengths in the text file reads.fasta.clusters.stats
+ * (clusters_stats), so that readers needing only these statistics do not have to scan the clusters.
+ *
+ * Optionally (ebwt2clust -s), a summary of the EGSA entries of each cluster is saved in
+ * reads.fasta.clusters.summary (cluster_summary), so that clusters can be filtered without reading the EGSA.
+ */
+
+#ifndef INTERNAL_CLUSTERS_HPP_
+#define INTERNAL_CLUSTERS_HPP_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "egsa2.hpp"
+
+using namespace std;
+
+struct clusters_header{
+
+	char magic[8];
+	uint32_t version;
+	uint32_t block_size;//clusters per index block
+	uint64_t n;//number of clusters
+	uint64_t n_blocks;
+	uint64_t index_offset;//byte offset of the index
+
+};
+
+struct clusters_block{
+
+	uint64_t offset;//byte offset of the first record of the block
+	uint64_t base;//end of the cluster preceding the block (0 for the first block)
+
+};
+
+static const char clusters_magic[8] = {'C','L','U','S','T','2','\0','\0'};
+static const uint32_t clusters_version = 2;
+static const uint32_t clusters_block_size = 1<<12;
+
+/*
+ * size in bytes and modification time of a file (0 if it does not exist). The sidecar files of the
+ * clusters file store its stamp, to detect sidecars that do not match the clusters.
+ */
+inline void file_stamp(string & path, uint64_t & size, int64_t & mtime){
+
+	struct stat st;
+
+	bool ok = stat(path.c_str(), &st) == 0;
+
+	size = ok ? st.st_size : 0;
+	mtime = ok ? st.st_mtime : 0;
+
+}
+
+/*
+ * number of clusters of each length, total number of clusters and of bases in clusters. The file
+ * (text) has the following lines:
+ *
+ * clusters_file_size <size in bytes of the clusters file>
+ * clusters_file_mtime <modification time of the clusters file>
+ * clusters <number of clusters>
+ * bases <number of bases in clusters>
+ * <length> <number of clusters with this length>     (one line per length, increasing lengths)
+ *
+ * The size and modification time of the clusters file are used to detect a sidecar that does not
+ * match the clusters (e.g. clusters rebuilt with other options, with the same size).
+ */
+class clusters_stats{
+
+public:
+
+	void add(uint64_t length){
+
+		if(length < small.size()) small[length]++;
+		else large[length]++;
+
+		n++;
+		bases += length;
+
+	}
+
+	/*
+	 * calls f(length, count) for each length (in increasing order) with count > 0
+	 */
+	template<typename F>
+	void for_each(F f){
+
+		for(uint64_t l = 0; l < small.size(); ++l) if(small[l] > 0) f(l, small[l]);
+		for(auto e : large) f(e.first, e.second);
+
+	}
+
+	uint64_t clusters(){
+
+		return n;
+
+	}
+
+	uint64_t n_bases(){
+
+		return bases;
+
+	}
+
+	void save(string & path, uint64_t clusters_file_size, int64_t clusters_file_mtime){
+
+		ofstream out(path);
+
+		if(not out.is_open()){
+
+			cout << "Error: could not create " << path << endl;
+			exit(1);
+
+		}
+
+		out << "clusters_file_size " << clusters_file_size << endl;
+		out << "clusters_file_mtime " << clusters_file_mtime << endl;
+		out << "clusters " << n << endl;
+		out << "bases " << bases << endl;
+
+		for_each([&](uint64_t l, uint64_t c){ out << l << " " << c << endl; });
+
+	}
+
+	/*
+	 * returns false if the file does not exist, is malformed, or does not match a clusters file
+	 * of the given size and modification time
+	 */
+	bool load(string & path, uint64_t clusters_file_size, int64_t clusters_file_mtime){
+
+		ifstream in(path);
+
+		if(not in.is_open()) return false;
+
+		string key_size, key_mtime, key_clusters, key_bases;
+		uint64_t size = 0;
+		int64_t mtime = 0;
+
+		in >> key_size >> size >> key_mtime >> mtime >> key_clusters >> n >> key_bases >> bases;
+
+		if(	not in or key_size != "clusters_file_size" or key_mtime != "clusters_file_mtime" or
+			key_clusters != "clusters" or key_bases != "bases" or
+			size != clusters_file_size or mtime != clusters_file_mtime) return false;
+
+		uint64_t l, c;
+		uint64_t total = 0;
+
+		while(in >> l >> c){
+
+			if(l < small.size()) small[l] += c;
+			else large[l] += c;
+
+			total += c;
+
+		}
+
+		return total == n;
+
+	}
+
+private:
+
+	vector<uint64_t> small = vector<uint64_t>(1<<16, 0);
+	map<uint64_t, uint64_t> large;//lengths not in small (rare)
+
+	uint64_t n = 0;
+	uint64_t bases = 0;
+
+};
+
+/*
+ * writes a clusters file (version 2), one cluster at a time, and its statistics (path.stats)
+ */
+class clusters_writer{
+
+public:
+
+	clusters_writer(){}
+
+	clusters_writer(string & path){
+
+		open(path);
+
+	}
+
+	~clusters_writer(){
+
+		close();
+
+	}
+
+	void open(string & path){
+
+		this->path = path;
+
+		stats_path = path;
+		stats_path.append(".stats");
+
+		out.open(path, ios::out | ios::binary);
+
+		if(not out.is_open()){
+
+			cout << "Error: could not create " << path << endl;
+			exit(1);
+
+		}
+
+		//placeholder, overwritten by close()
+		clusters_header h = {};
+		out.write((char*)&h, sizeof(clusters_header));
+
+		offset = sizeof(clusters_header);
+
+	}
+
+	/*
+	 * clusters must be appended in increasing order of start and cannot overlap
+	 */
+	void append(uint64_t start, uint64_t length){
+
+		if(n % clusters_block_size == 0) index.push_back({offset + buf.size(), base});
+
+		put_varint(buf, start - base);
+		put_varint(buf, length);
+
+		base = start + length;
+		n++;
+
+		stats.add(length);
+
+		if(buf.size() >= (1<<20)) flush();
+
+	}
+
+	/*
+	 * write the records left, the index, and the header
+	 */
+	void close(){
+
+		if(not out.is_open()) return;
+
+		flush();
+
+		clusters_header h = {};
+		memcpy(h.magic, clusters_magic, 8);
+		h.version = clusters_version;
+		h.block_size = clusters_block_size;
+		h.n = n;
+		h.n_blocks = index.size();
+		h.index_offset = offset;
+
+		out.write((char*)index.data(), index.size() * sizeof(clusters_block));
+
+		out.seekp(0);
+		out.write((char*)&h, sizeof(clusters_header));
+
+		out.close();
+
+		uint64_t size;
+		int64_t mtime;
+		file_stamp(path, size, mtime);
+
+		stats.save(stats_path, size, mtime);
+
+	}
+
+	/*
+	 * number of clusters written so far
+	 */
+	uint64_t size(){
+
+		return n;
+
+	}
+
+	/*
+	 * size in bytes of the file (after close())
+	 */
+	uint64_t bytes(){
+
+		return offset + index.size() * sizeof(clusters_block);
+
+	}
+
+private:
+
+	void flush(){
+
+		out.write((char*)buf.data(), buf.size());
+		offset += buf.size();
+		buf.clear();
+
+	}
+
+	ofstream out;
+
+	vector<uint8_t> buf;//records not yet written
+	vector<clusters_block> index;
+
+	clusters_stats stats;
+	string path;
+	string stats_path;
+
+	uint64_t offset = 0;//bytes written to file
+	uint64_t base = 0;//end of the last cluster
+	uint64_t n = 0;
+
+};
+
+/*
+ * reads a clusters file in either format
+ */
+class clusters_reader{
+
+public:
+
+	clusters_reader(string & path){
+
+		in.open(path, ios::in | ios::binary);
+
+		if(not in.is_open()){
+
+			cout << "Error: could not open " << path << endl;
+			exit(1);
+
+		}
+
+		in.seekg(0, ios::end);
+		uint64_t file_size = in.tellg();
+		in.seekg(0, ios::beg);
+
+		clusters_header h = {};
+
+		if(file_size >= sizeof(clusters_header)) in.read((char*)&h, sizeof(clusters_header));
+
+		if(	file_size >= sizeof(clusters_header) and memcmp(h.magic, clusters_magic, 8) == 0 and
+			h.version == clusters_version and h.index_offset + h.n_blocks * sizeof(clusters_block) == file_size){
+
+			H = h;
+
+			index = vector<clusters_block>(H.n_blocks);
+			in.seekg(H.index_offset);
+			in.read((char*)index.data(), H.n_blocks * sizeof(clusters_block));
+
+			data_end = H.index_offset;
+
+		}else{
+
+			legacy = true;
+
+			H.n = file_size / legacy_size;
+			data_end = H.n * legacy_size;
+
+		}
+
+		seek(0);
+
+	}
+
+	/*
+	 * true if the file is in the legacy format (10 bytes per cluster)
+	 */
+	bool is_legacy(){
+
+		return legacy;
+
+	}
+
+	/*
+	 * number of clusters in the file
+	 */
+	uint64_t size(){
+
+		return H.n;
+
+	}
+
+	/*
+	 * number of the next cluster returned by next()
+	 */
+	uint64_t position(){
+
+		return c;
+
+	}
+
+	/*
+	 * read the next cluster. Returns false (start and length untouched) if there are no clusters left.
+	 */
+	bool next(uint64_t & start, uint64_t & length){
+
+		if(c >= H.n) return false;
+
+		fill();
+
+		const uint8_t * p = buf.data() + buf_pos;
+
+		if(legacy){
+
+			uint16_t len16;
+			memcpy(&start, p, sizeof(uint64_t));
+			memcpy(&len16, p + sizeof(uint64_t), sizeof(uint16_t));
+			length = len16;
+			p += legacy_size;
+
+		}else{
+
+			start = base + get_varint(p);
+			length = get_varint(p);
+			base = start + length;
+
+		}
+
+		buf_pos = p - buf.data();
+		c++;
+
+		return true;
+
+	}
+
+	/*
+	 * the next cluster returned by next() will be cluster number j (0-based)
+	 */
+	void seek(uint64_t j){
+
+		j = j < H.n ? j : H.n;
+
+		if(legacy){
+
+			move_to(j * legacy_size);
+			c = j;
+
+			return;
+
+		}
+
+		//jump to the block containing cluster j and skip the clusters preceding it
+		uint64_t b = j / H.block_size;
+
+		if(b >= index.size()){
+
+			move_to(data_end);
+			c = H.n;
+
+			return;
+
+		}
+
+		move_to(index[b].offset);
+		base = index[b].base;
+		c = b * H.block_size;
+
+		uint64_t start, length;
+		while(c < j) next(start, length);
+
+	}
+
+	/*
+	 * the next cluster returned by next() will be the first one ending after EGSA position j
+	 * (the cluster containing j, if there is one)
+	 */
+	void seek_position(uint64_t j){
+
+		if(legacy){
+
+			//binary search on the records
+			uint64_t lo = 0;
+			uint64_t hi = H.n;
+
+			while(lo < hi){
+
+				uint64_t mid = (lo + hi) / 2;
+				uint64_t start, length;
+
+				seek(mid);
+				next(start, length);
+
+				if(start + length > j) hi = mid;
+				else lo = mid + 1;
+
+			}
+
+			seek(lo);
+
+			return;
+
+		}
+
+		//last block starting after a cluster that ends at or before j
+		uint64_t b = 0;
+		uint64_t lo = 0;
+		uint64_t hi = index.size();
+
+		while(lo < hi){
+
+			uint64_t mid = (lo + hi) / 2;
+
+			if(index[mid].base <= j){
+
+				b = mid;
+				lo = mid + 1;
+
+			}else{
+
+				hi = mid;
+
+			}
+
+		}
+
+		seek(b * H.block_size);
+
+		uint64_t mark = c;
+		uint64_t start, length;
+
+		while(next(start, length)){
+
+			if(start + length > j) break;
+			mark = c;
+
+		}
+
+		seek(mark);
+
+	}
+
+private:
+
+	/*
+	 * make sure that the buffer contains the next record
+	 */
+	void fill(){
+
+		if(buf_len - buf_pos >= max_record or file_pos == data_end) return;
+
+		memmove(buf.data(), buf.data() + buf_pos, buf_len - buf_pos);
+		buf_len -= buf_pos;
+		buf_pos = 0;
+
+		uint64_t len = buf.size() - buf_len < data_end - file_pos ? buf.size() - buf_len : data_end - file_pos;
+
+		in.seekg(file_pos);
+		in.read((char*)buf.data() + buf_len, len);
+
+		buf_len += len;
+		file_pos += len;
+
+	}
+
+	/*
+	 * the next record starts at byte offset off
+	 */
+	void move_to(uint64_t off){
+
+		//still in the buffer?
+		if(off <= file_pos and off + buf_len >= file_pos){
+
+			buf_pos = buf_len - (file_pos - off);
+			return;
+
+		}
+
+		file_pos = off;
+		buf_pos = buf_len = 0;
+
+	}
+
+	static const uint64_t legacy_size = sizeof(uint64_t) + sizeof(uint16_t);
+	static const uint64_t max_record = 20;//two varints
+
+	ifstream in;
+
+	clusters_header H = {};
+	vector<clusters_block> index;
+
+	bool legacy = false;
+	uint64_t data_end = 0;//end of the records
+
+	vector<uint8_t> buf = vector<uint8_t>(1<<20);
+	uint64_t buf_pos = 0;
+	uint64_t buf_len = 0;
+	uint64_t file_pos = 0;//file offset of buf[buf_len]
+
+	uint64_t c = 0;//number of the next cluster
+	uint64_t base = 0;//end of the previous cluster
+
+};
+
+/*
+ * summary of the EGSA entries of a cluster: what clust2snp needs to decide whether a cluster can
+ * contain a variant. Sample 0 contains the reads with number smaller than nr_reads1, sample 1 the others.
+ */
+struct cluster_summary{
+
+	uint32_t counts[2][4];//BWT characters A,C,G,T in each sample (characters other than A,C,G,T,N count as A)
+	uint32_t n_N;//BWT characters N (both samples)
+	uint32_t max_lcp;//max LCP in the cluster
+
+};
+
+/*
+ * the summary file has a header followed by one record (the fields of cluster_summary, as varints)
+ * per cluster, in the same order as the clusters file. The header records the size and modification
+ * time of the clusters file and the sample boundary used to compute the summaries.
+ */
+struct summary_header{
+
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t n;//number of clusters
+	uint64_t nr_reads1;//number of reads in the first sample
+	uint64_t clusters_file_size;
+	int64_t clusters_file_mtime;
+
+};
+
+static const char summary_magic[8] = {'C','L','S','U','M','\0','\0','\0'};
+static const uint32_t summary_version = 3;
+
+class summary_writer{
+
+public:
+
+	summary_writer(string & path){
+
+		out.open(path, ios::out | ios::binary);
+
+		if(not out.is_open()){
+
+			cout << "Error: could not create " << path << endl;
+			exit(1);
+
+		}
+
+		//placeholder, overwritten by close()
+		summary_header h = {};
+		out.write((char*)&h, sizeof(summary_header));
+
+	}
+
+	~summary_writer(){
+
+		if(out.is_open()) out.close();
+
+	}
+
+	void append(cluster_summary & s){
+
+		for(int sample = 0; sample < 2; ++sample)
+			for(int c = 0; c < 4; ++c)
+				put_varint(buf, s.counts[sample][c]);
+
+		put_varint(buf, s.n_N);
+		put_varint(buf, s.max_lcp);
+
+		n++;
+
+		if(buf.size() >= (1<<20)) flush();
+
+	}
+
+	/*
+	 * write the records left and the header
+	 */
+	void close(uint64_t nr_reads1, uint64_t clusters_file_size, int64_t clusters_file_mtime){
+
+		flush();
+
+		summary_header h = {};
+		memcpy(h.magic, summary_magic, 8);
+		h.version = summary_version;
+		h.n = n;
+		h.nr_reads1 = nr_reads1;
+		h.clusters_file_size = clusters_file_size;
+		h.clusters_file_mtime = clusters_file_mtime;
+
+		out.seekp(0);
+		out.write((char*)&h, sizeof(summary_header));
+
+		out.close();
+
+	}
+
+private:
+
+	void flush(){
+
+		out.write((char*)buf.data(), buf.size());
+		buf.clear();
+
+	}
+
+	ofstream out;
+	vector<uint8_t> buf;
+
+	uint64_t n = 0;
+
+};
+
+class summary_reader{
+
+public:
+
+	/*
+	 * if the file does not exist or is not a summary file, is_open() is false
+	 */
+	summary_reader(string & path){
+
+		in.open(path, ios::in | ios::binary);
+
+		if(not in.is_open()) return;
+
+		in.read((char*)&H, sizeof(summary_header));
+
+		if(not in or memcmp(H.magic, summary_magic, 8) != 0 or H.version != summary_version) in.close();
+
+	}
+
+	bool is_open(){
+
+		return in.is_open();
+
+	}
+
+	/*
+	 * true if the summaries refer to the given clusters file (number of clusters, size and modification
+	 * time) and sample boundary
+	 */
+	bool matches(uint64_t n_clusters, uint64_t clusters_file_size, int64_t clusters_file_mtime, uint64_t nr_reads1){
+
+		return	is_open() and H.n == n_clusters and H.clusters_file_size == clusters_file_size and
+				H.clusters_file_mtime == clusters_file_mtime and H.nr_reads1 == nr_reads1;
+
+	}
+
+	/*
+	 * read the summary of the next cluster. Returns false if there are no summaries left.
+	 */
+	bool next(cluster_summary & s){
+
+		if(c >= H.n) return false;
+
+		//make sure that the buffer contains the next record
+		if(buf_len - buf_pos < max_record and not in.eof()){
+
+			memmove(buf.data(), buf.data() + buf_pos, buf_len - buf_pos);
+			buf_len -= buf_pos;
+			buf_pos = 0;
+
+			in.read((char*)buf.data() + buf_len, buf.size() - buf_len);
+			buf_len += in.gcount();
+
+		}
+
+		const uint8_t * p = buf.data() + buf_pos;
+
+		for(int sample = 0; sample < 2; ++sample)
+			for(int ch = 0; ch < 4; ++ch)
+				s.counts[sample][ch] = get_varint(p);
+
+		s.n_N = get_varint(p);
+		s.max_lcp = get_varint(p);
+
+		buf_pos = p - buf.data();
+		c++;
+
+		return true;
+
+	}
+
+private:
+
+	static const uint64_t max_record = 10*5;//10 varints of 32-bit values
+
+	ifstream in;
+	summary_header H = {};
+
+	vector<uint8_t> buf = vector<uint8_t>(1<<20);
+	uint64_t buf_pos = 0;
+	uint64_t buf_len = 0;
+
+	uint64_t c = 0;//number of the next cluster
+
+};
+
+#endif /* INTERNAL_CLUSTERS_HPP_ */
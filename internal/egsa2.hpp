@@ -0,0 +1,531 @@
+/*
+ * egsa2.hpp
+ *
+ * Compact columnar on-disk format for the EGSA ("egsa2"). The entries are grouped in blocks of
+ * fixed size; inside a block each component is stored as a separate column:
+ *
+ * - DA (read number) and suff (position in read): frame of reference (block minimum) + bit-packing
+ * - LCP: varint
+ * - BWT: 2 bits per base plus a list of exceptions (characters other than A,C,G,T), or
+ *   run-length encoded if this is smaller (high-coverage data)
+ *
+ * A directory at the end of the file stores the byte offset of each block (random access).
+ *
+ * File layout:
+ *
+ * header | block 0 | block 1 | ... | directory (one uint64_t offset per block)
+ *
+ */
+
+#ifndef INTERNAL_EGSA2_HPP_
+#define INTERNAL_EGSA2_HPP_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * varint (LEB128) coding of unsigned integers
+ */
+inline void put_varint(vector<uint8_t> & out, uint64_t x){
+
+	while(x >= 128){
+
+		out.push_back(uint8_t(x) | 128);
+		x >>= 7;
+
+	}
+
+	out.push_back(uint8_t(x));
+
+}
+
+inline uint64_t get_varint(const uint8_t * & p){
+
+	uint64_t x = 0;
+	int shift = 0;
+
+	while(*p & 128){
+
+		x |= uint64_t(*p++ & 127) << shift;
+		shift += 7;
+
+	}
+
+	x |= uint64_t(*p++) << shift;
+
+	return x;
+
+}
+
+/*
+ * number of bits needed to write x
+ */
+inline int bit_width(uint64_t x){
+
+	return x == 0 ? 0 : 64 - __builtin_clzll(x);
+
+}
+
+/*
+ * store n values of w <= 32 bits each, least significant bits first
+ */
+inline void put_packed(vector<uint8_t> & out, const uint32_t * v, uint64_t n, uint32_t base, int w){
+
+	uint64_t acc = 0;
+	int bits = 0;
+
+	for(uint64_t j = 0; j < n; ++j){
+
+		acc |= uint64_t(v[j] - base) << bits;
+		bits += w;
+
+		while(bits >= 8){
+
+			out.push_back(uint8_t(acc));
+			acc >>= 8;
+			bits -= 8;
+
+		}
+
+	}
+
+	if(bits > 0) out.push_back(uint8_t(acc));
+
+}
+
+inline void get_packed(const uint8_t * & p, uint32_t * v, uint64_t n, uint32_t base, int w){
+
+	uint64_t acc = 0;
+	int bits = 0;
+	uint64_t mask = (uint64_t(1) << w) - 1;
+
+	for(uint64_t j = 0; j < n; ++j){
+
+		while(bits < w){
+
+			acc |= uint64_t(*p++) << bits;
+			bits += 8;
+
+		}
+
+		v[j] = base + uint32_t(acc & mask);
+		acc >>= w;
+		bits -= w;
+
+	}
+
+}
+
+struct egsa2_header{
+
+	char magic[8];
+	uint32_t version;
+	uint32_t block_size;//entries per block
+	uint64_t n;//number of entries
+	uint64_t n_blocks;
+	uint64_t dir_offset;//byte offset of the block directory
+	uint64_t source_size;//size in bytes of the EGSA/BCR index it was converted from (to detect a stale egsa2 file)
+	int64_t source_mtime;//modification time of the EGSA/BCR index
+
+};
+
+static const char egsa2_magic[8] = {'E','G','S','A','2','\0','\0','\0'};
+static const uint32_t egsa2_version = 2;
+static const uint32_t egsa2_block_size = 1<<16;
+
+/*
+ * the columns of one block
+ */
+class egsa2_block{
+
+public:
+
+	vector<uint32_t> text;
+	vector<uint32_t> suff;
+	vector<uint32_t> lcp;
+	vector<uint8_t> bwt;
+
+	uint64_t size(){
+
+		return lcp.size();
+
+	}
+
+	void clear(){
+
+		text.clear();
+		suff.clear();
+		lcp.clear();
+		bwt.clear();
+
+	}
+
+	void encode(vector<uint8_t> & out){
+
+		uint64_t count = size();
+
+		put_varint(out, count);
+
+		if(count == 0) return;
+
+		put_column(out, text);
+		put_column(out, suff);
+
+		for(auto l : lcp) put_varint(out, l);
+
+		//BWT: choose between 2-bit packing + exceptions and run-length encoding
+		vector<uint8_t> packed;
+		vector<uint8_t> rle;
+
+		encode_bwt_packed(packed);
+		encode_bwt_rle(rle);
+
+		if(rle.size() < packed.size()){
+
+			out.push_back(1);
+			out.insert(out.end(), rle.begin(), rle.end());
+
+		}else{
+
+			out.push_back(0);
+			out.insert(out.end(), packed.begin(), packed.end());
+
+		}
+
+	}
+
+	/*
+	 * decode the block stored in [p, end). Columns not requested are skipped and filled with 0.
+	 * Returns false if the block is corrupt (it does not fit in [p, end) or its columns are not consistent).
+	 */
+	bool decode(const uint8_t * p, const uint8_t * end, bool need_text = true, bool need_suff = true, bool need_lcp = true, bool need_bwt = true){
+
+		uint64_t count = get_varint(p);
+
+		//each entry takes at least one byte (its LCP varint)
+		if(p > end or count > uint64_t(end - p)) return false;
+
+		text.resize(count);
+		suff.resize(count);
+		lcp.resize(count);
+		bwt.resize(count);
+
+		if(count == 0) return true;
+
+		if(not (need_text ? get_column(p, end, text) : skip_column(p, end, text))) return false;
+		if(not (need_suff ? get_column(p, end, suff) : skip_column(p, end, suff))) return false;
+
+		uint64_t j = 0;
+
+		if(need_lcp){
+
+			for(; j < count and p < end; ++j) lcp[j] = get_varint(p);
+
+		}else{
+
+			for(; j < count and p < end; ++j) while(*p++ & 128);
+			lcp.assign(count, 0);
+
+		}
+
+		if(j < count or p > end) return false;
+
+		if(not need_bwt){
+
+			bwt.assign(count, 0);
+			return p <= end;
+
+		}
+
+		if(p >= end) return false;
+
+		uint8_t mode = *p++;
+
+		if(mode == 0){
+
+			const char * ACGT = "ACGT";
+
+			if(uint64_t(end - p) < (count+3)/4) return false;
+
+			for(uint64_t j = 0; j < count; ++j) bwt[j] = ACGT[(p[j/4] >> (2*(j%4))) & 3];
+			p += (count+3)/4;
+
+			if(p >= end) return false;
+
+			uint64_t n_exc = get_varint(p);
+			uint64_t pos = 0;
+
+			for(uint64_t e = 0; e < n_exc; ++e){
+
+				if(p >= end) return false;
+
+				pos += get_varint(p);
+
+				if(pos >= count or p >= end) return false;
+
+				bwt[pos] = *p++;
+
+			}
+
+		}else if(mode == 1){
+
+			j = 0;
+
+			while(j < count){
+
+				if(p >= end) return false;
+
+				uint8_t c = *p++;
+				uint64_t len = get_varint(p);
+
+				if(len > count - j) return false;
+
+				memset(bwt.data() + j, c, len);
+				j += len;
+
+			}
+
+		}else{
+
+			return false;
+
+		}
+
+		return p <= end;
+
+	}
+
+private:
+
+	static int base_code(uint8_t c){
+
+		switch(c){
+
+			case 'A': return 0; break;
+			case 'C': return 1; break;
+			case 'G': return 2; break;
+			case 'T': return 3; break;
+
+		}
+
+		return -1;
+
+	}
+
+	static void put_column(vector<uint8_t> & out, vector<uint32_t> & v){
+
+		uint32_t min = v[0];
+		uint32_t max = v[0];
+
+		for(auto x : v){
+
+			min = x < min ? x : min;
+			max = x > max ? x : max;
+
+		}
+
+		int w = bit_width(max - min);
+
+		put_varint(out, min);
+		out.push_back(w);
+		put_packed(out, v.data(), v.size(), min, w);
+
+	}
+
+	/*
+	 * false if the column does not fit in [p, end)
+	 */
+	static bool get_column(const uint8_t * & p, const uint8_t * end, vector<uint32_t> & v){
+
+		uint32_t min = get_varint(p);
+
+		if(p >= end) return false;
+
+		int w = *p++;
+
+		if(w > 32 or uint64_t(end - p) < (v.size() * w + 7) / 8) return false;
+
+		get_packed(p, v.data(), v.size(), min, w);
+
+		return true;
+
+	}
+
+	static bool skip_column(const uint8_t * & p, const uint8_t * end, vector<uint32_t> & v){
+
+		get_varint(p);
+
+		if(p >= end) return false;
+
+		int w = *p++;
+
+		if(w > 32 or uint64_t(end - p) < (v.size() * w + 7) / 8) return false;
+
+		p += (v.size() * w + 7) / 8;
+		v.assign(v.size(), 0);
+
+		return true;
+
+	}
+
+	void encode_bwt_packed(vector<uint8_t> & out){
+
+		uint64_t count = size();
+
+		vector<uint8_t> bits((count+3)/4, 0);
+		vector<uint8_t> exc;
+		uint64_t n_exc = 0;
+		uint64_t last = 0;
+
+		for(uint64_t j = 0; j < count; ++j){
+
+			int c = base_code(bwt[j]);
+
+			if(c < 0){
+
+				put_varint(exc, j - last);
+				exc.push_back(bwt[j]);
+				last = j;
+				n_exc++;
+				c = 0;
+
+			}
+
+			bits[j/4] |= c << (2*(j%4));
+
+		}
+
+		out.insert(out.end(), bits.begin(), bits.end());
+		put_varint(out, n_exc);
+		out.insert(out.end(), exc.begin(), exc.end());
+
+	}
+
+	void encode_bwt_rle(vector<uint8_t> & out){
+
+		uint64_t j = 0;
+
+		while(j < size()){
+
+			uint64_t len = 1;
+			while(j + len < size() and bwt[j + len] == bwt[j]) len++;
+
+			out.push_back(bwt[j]);
+			put_varint(out, len);
+
+			j += len;
+
+		}
+
+	}
+
+};
+
+/*
+ * writes an egsa2 file, one entry at a time
+ */
+class egsa2_writer{
+
+public:
+
+	egsa2_writer(string & path){
+
+		out.open(path, ios::out | ios::binary);
+
+		if(not out.is_open()){
+
+			cout << "Error: could not create " << path << endl;
+			exit(1);
+
+		}
+
+		//placeholder, overwritten by close()
+		egsa2_header h = {};
+		out.write((char*)&h, sizeof(egsa2_header));
+
+		offset = sizeof(egsa2_header);
+
+	}
+
+	void append(uint32_t text, uint32_t suff, uint32_t lcp, uint8_t bwt){
+
+		B.text.push_back(text);
+		B.suff.push_back(suff);
+		B.lcp.push_back(lcp);
+		B.bwt.push_back(bwt);
+
+		if(B.size() == egsa2_block_size) flush();
+
+	}
+
+	/*
+	 * write the last block, the directory, and the header. source_size and source_mtime identify the
+	 * EGSA/BCR index the entries were read from (0 if unknown).
+	 */
+	void close(uint64_t source_size, int64_t source_mtime){
+
+		if(B.size() > 0) flush();
+
+		egsa2_header h = {};
+		memcpy(h.magic, egsa2_magic, 8);
+		h.version = egsa2_version;
+		h.block_size = egsa2_block_size;
+		h.n = n;
+		h.n_blocks = directory.size();
+		h.dir_offset = offset;
+		h.source_size = source_size;
+		h.source_mtime = source_mtime;
+
+		out.write((char*)directory.data(), directory.size() * sizeof(uint64_t));
+
+		out.seekp(0);
+		out.write((char*)&h, sizeof(egsa2_header));
+
+		out.close();
+
+	}
+
+	/*
+	 * size in bytes of the file written so far
+	 */
+	uint64_t bytes(){
+
+		return offset + directory.size() * sizeof(uint64_t);
+
+	}
+
+private:
+
+	void flush(){
+
+		vector<uint8_t> data;
+		B.encode(data);
+
+		directory.push_back(offset);
+		out.write((char*)data.data(), data.size());
+
+		offset += data.size();
+		n += B.size();
+
+		B.clear();
+
+	}
+
+	ofstream out;
+
+	egsa2_block B;
+	vector<uint64_t> directory;
+
+	uint64_t offset = 0;
+	uint64_t n = 0;
+
+};
+
+#endif /* INTERNAL_EGSA2_HPP_ */
@@ -0,0 +1,192 @@
+/*
+ * lcp_clusters.hpp
+ *
+ * Clusters of the EGSA: regions between local LCP minima, excluding tails where LCP < k. Scanning the
+ * LCP array from left to right:
+ *
+ * - a cluster is opened in the first position with LCP >= k
+ * - the cluster open in position i (i > 0) is closed in i if LCP[i-1] > LCP[i] and LCP[i] <= LCP[i+1]
+ *   (i is the start of a, possibly flat, local minimum), or if LCP[i+1] < k
+ * - the (virtual) entry n following the last one has LCP 0
+ *
+ * The LCP array is processed in chunks, which can be scanned independently (e.g. by different
+ * threads) and are then stitched in order. Used by ebwt2clust and by the fused mode of clust2snp.
+ */
+
+#ifndef INTERNAL_LCP_CLUSTERS_HPP_
+#define INTERNAL_LCP_CLUSTERS_HPP_
+
+#include <cstdint>
+#include <vector>
+#include "lcp_kernel.hpp"
+
+using namespace std;
+
+/*
+ * clusters found in a chunk [a, b) of the LCP array, starting the scan with no open cluster.
+ * Up to the first position where a cluster would be closed (first_close), the result depends on
+ * the clusters still open at the end of the previous chunks: this is fixed by stitch().
+ */
+struct chunk_clusters{
+
+	uint64_t first_close;//first position in [a, b) closing a cluster (if one is open), or null
+	uint64_t first_start;//start of the cluster closed in first_close if no cluster is open on entering the chunk, or null
+	vector<pair<uint64_t, uint64_t> > clusters;//clusters [start, end] closed after first_close
+	uint64_t open_start;//start of the cluster still open at the end of the chunk, or null
+
+	//bitmasks of the chunk: positions closing a cluster, positions with LCP >= k
+	vector<uint64_t> close;
+	vector<uint64_t> ge;
+
+};
+
+/*
+ * position of the first bit set in B at position >= j, or n if there is none before position n
+ */
+inline uint64_t next_one(const vector<uint64_t> & B, uint64_t j, uint64_t n){
+
+	if(j >= n) return n;
+
+	uint64_t w = j/64;
+	uint64_t word = B[w] & (~uint64_t(0) << (j%64));
+
+	while(word == 0){
+
+		if(++w * 64 >= n) return n;
+		word = B[w];
+
+	}
+
+	uint64_t pos = w*64 + __builtin_ctzll(word);
+
+	return pos < n ? pos : n;
+
+}
+
+/*
+ * scan chunk [a, b) of the LCP array. lcp[j] is the LCP value
+ * in position a - 1 + j, for j = 0, ..., b - a + 1 (lcp[0] is not used if a = 0).
+ *
+ * lcp2 (position i) is the start of a (possibly flat) local minimum if lcp1 > lcp2 and lcp2 <= lcp3:
+ * a cluster open in i is closed in i if this holds, or if lcp3 < k. Then a new cluster is opened
+ * in the first position with LCP >= k. The comparisons are done by the (vectorized) kernel in
+ * lcp_kernel.hpp, then clusters are found by jumping between the bits set in the masks.
+ */
+inline void scan_chunk(const uint32_t * lcp, uint64_t a, uint64_t b, uint32_t k, chunk_clusters & R){
+
+	uint64_t null = ~uint64_t(0);
+
+	uint64_t m = b - a;
+	uint64_t words = m/64 + 1;//one more bit for position b
+
+	R.close.resize(words);
+	R.ge.resize(words);
+	R.clusters.clear();
+
+	//local minima and LCP < k in [a, b). The mask of the latter is then completed with position b
+	R.ge[words-1] = 0;
+	lcp_masks(lcp + 1, m, k, R.close.data(), R.ge.data());
+	if(lcp[m+1] < k) R.ge[m/64] |= uint64_t(1) << (m%64);
+
+	for(uint64_t w = 0; w < words; ++w){
+
+		//position i closes a cluster if it is a local minimum or if LCP[i+1] < k
+		if(w < (m+63)/64) R.close[w] |= (R.ge[w] >> 1) | (w + 1 < words ? R.ge[w+1] << 63 : 0);
+		else R.close[w] = R.ge[w] >> 1;
+
+		R.ge[w] = ~R.ge[w];
+
+	}
+
+	//the first entry of the LCP array does not close clusters
+	if(a == 0) R.close[0] &= ~uint64_t(1);
+
+	uint64_t c0 = next_one(R.close, 0, m);
+	uint64_t f = next_one(R.ge, 0, m);
+
+	if(c0 == m){
+
+		R.first_close = null;
+		R.first_start = null;
+		R.open_start = f < m ? a + f : null;
+
+		return;
+
+	}
+
+	R.first_close = a + c0;
+	R.first_start = f <= c0 ? a + f : null;
+
+	uint64_t j = c0 + 1;
+
+	while(true){
+
+		uint64_t s = next_one(R.ge, j, m);
+
+		if(s == m){
+
+			R.open_start = null;
+			return;
+
+		}
+
+		uint64_t e = next_one(R.close, s, m);
+
+		if(e == m){
+
+			R.open_start = a + s;
+			return;
+
+		}
+
+		R.clusters.push_back({a + s, a + e});
+		j = e + 1;
+
+	}
+
+}
+
+/*
+ * report the clusters of the next chunk, in order, with emit(start, end) (end included). start is
+ * the cluster still open at the end of the previous chunks (null if none).
+ */
+template<typename F>
+void stitch(chunk_clusters & R, uint64_t & start, F emit){
+
+	uint64_t null = ~uint64_t(0);
+
+	if(R.first_close == null){
+
+		start = start != null ? start : R.open_start;
+		return;
+
+	}
+
+	start = start != null ? start : R.first_start;
+
+	if(start != null) emit(start, R.first_close);
+
+	for(auto c : R.clusters) emit(c.first, c.second);
+
+	start = R.open_start;
+
+}
+
+/*
+ * after the last chunk: the (virtual) entry n, with LCP 0, can still open a cluster. If a cluster
+ * is open, it is closed there.
+ */
+template<typename F>
+void close_last(uint64_t n, uint64_t start, uint32_t k, F emit){
+
+	uint64_t null = ~uint64_t(0);
+
+	if(n == 0) return;
+
+	if(start==null and k == 0) start = n;//LCP 0 >= k
+
+	if(start != null) emit(start, n);
+
+}
+
+#endif /* INTERNAL_LCP_CLUSTERS_HPP_ */
@@ -0,0 +1,172 @@
+/*
+ * lcp_kernel.hpp
+ *
+ * Vectorized detection of local LCP minima, used by ebwt2clust to compute the clusters. For a block
+ * of LCP values, the kernel produces two bitmasks (bit j of word j/64 refers to the j-th value):
+ *
+ * - lmin: the j-th value is the first position of a (possibly flat) local minimum, that is,
+ *   L[j-1] > L[j] and L[j] <= L[j+1]
+ * - below: L[j] < k
+ *
+ * The values L[-1] and L[n] (the neighbours of the block) must be readable: flat minima that cross
+ * the edges of a block are found by passing the previous/next values.
+ *
+ * The AVX2 and SSE4.1 versions are compiled with target attributes and selected at run time
+ * depending on the CPU; on other architectures (or CPUs) the scalar version is used.
+ *
+ */
+
+#ifndef INTERNAL_LCP_KERNEL_HPP_
+#define INTERNAL_LCP_KERNEL_HPP_
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LCP_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+typedef void (*lcp_kernel_t)(const uint32_t * L, uint64_t n, uint32_t k, uint64_t * lmin, uint64_t * below);
+
+/*
+ * reference implementation: the same comparisons done by cluster_lm on each triple of LCP values
+ */
+inline void lcp_masks_scalar(const uint32_t * L, uint64_t n, uint32_t k, uint64_t * lmin, uint64_t * below){
+
+	memset(lmin, 0, ((n + 63) / 64) * sizeof(uint64_t));
+	memset(below, 0, ((n + 63) / 64) * sizeof(uint64_t));
+
+	for(uint64_t j = 0; j < n; ++j){
+
+		uint32_t lcp1 = L[j-1];
+		uint32_t lcp2 = L[j];
+		uint32_t lcp3 = L[j+1];
+
+		if(lcp1 > lcp2 and lcp2 <= lcp3) lmin[j/64] |= uint64_t(1) << (j%64);
+		if(lcp2 < k) below[j/64] |= uint64_t(1) << (j%64);
+
+	}
+
+}
+
+#ifdef LCP_KERNEL_X86
+
+/*
+ * 8 values per step. There are no unsigned comparisons in AVX2: x >= y iff max(x,y) = x
+ */
+__attribute__((target("avx2")))
+inline void lcp_masks_avx2(const uint32_t * L, uint64_t n, uint32_t k, uint64_t * lmin, uint64_t * below){
+
+	const __m256i K = _mm256_set1_epi32(k);
+
+	uint64_t j = 0;
+
+	for(; j + 64 <= n; j += 64){
+
+		uint64_t m_lmin = 0;
+		uint64_t m_below = 0;
+
+		for(int s = 0; s < 64; s += 8){
+
+			__m256i lcp1 = _mm256_loadu_si256((const __m256i*)(L + j + s - 1));
+			__m256i lcp2 = _mm256_loadu_si256((const __m256i*)(L + j + s));
+			__m256i lcp3 = _mm256_loadu_si256((const __m256i*)(L + j + s + 1));
+
+			__m256i le12 = _mm256_cmpeq_epi32(_mm256_max_epu32(lcp1, lcp2), lcp2);//lcp1 <= lcp2
+			__m256i le23 = _mm256_cmpeq_epi32(_mm256_max_epu32(lcp2, lcp3), lcp3);//lcp2 <= lcp3
+			__m256i ge2k = _mm256_cmpeq_epi32(_mm256_max_epu32(lcp2, K), lcp2);//lcp2 >= k
+
+			uint64_t b_lmin = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(le12, le23)));
+			uint64_t b_ge = _mm256_movemask_ps(_mm256_castsi256_ps(ge2k));
+
+			m_lmin |= b_lmin << s;
+			m_below |= (~b_ge & 0xFF) << s;
+
+		}
+
+		lmin[j/64] = m_lmin;
+		below[j/64] = m_below;
+
+	}
+
+	if(j < n) lcp_masks_scalar(L + j, n - j, k, lmin + j/64, below + j/64);
+
+}
+
+/*
+ * 4 values per step
+ */
+__attribute__((target("sse4.1")))
+inline void lcp_masks_sse4(const uint32_t * L, uint64_t n, uint32_t k, uint64_t * lmin, uint64_t * below){
+
+	const __m128i K = _mm_set1_epi32(k);
+
+	uint64_t j = 0;
+
+	for(; j + 64 <= n; j += 64){
+
+		uint64_t m_lmin = 0;
+		uint64_t m_below = 0;
+
+		for(int s = 0; s < 64; s += 4){
+
+			__m128i lcp1 = _mm_loadu_si128((const __m128i*)(L + j + s - 1));
+			__m128i lcp2 = _mm_loadu_si128((const __m128i*)(L + j + s));
+			__m128i lcp3 = _mm_loadu_si128((const __m128i*)(L + j + s + 1));
+
+			__m128i le12 = _mm_cmpeq_epi32(_mm_max_epu32(lcp1, lcp2), lcp2);
+			__m128i le23 = _mm_cmpeq_epi32(_mm_max_epu32(lcp2, lcp3), lcp3);
+			__m128i ge2k = _mm_cmpeq_epi32(_mm_max_epu32(lcp2, K), lcp2);
+
+			uint64_t b_lmin = _mm_movemask_ps(_mm_castsi128_ps(_mm_andnot_si128(le12, le23)));
+			uint64_t b_ge = _mm_movemask_ps(_mm_castsi128_ps(ge2k));
+
+			m_lmin |= b_lmin << s;
+			m_below |= (~b_ge & 0xF) << s;
+
+		}
+
+		lmin[j/64] = m_lmin;
+		below[j/64] = m_below;
+
+	}
+
+	if(j < n) lcp_masks_scalar(L + j, n - j, k, lmin + j/64, below + j/64);
+
+}
+
+#endif
+
+/*
+ * the fastest kernel supported by this CPU
+ */
+inline lcp_kernel_t lcp_masks_kernel(){
+
+#ifdef LCP_KERNEL_X86
+
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("avx2")) return lcp_masks_avx2;
+	if(__builtin_cpu_supports("sse4.1")) return lcp_masks_sse4;
+
+#endif
+
+	return lcp_masks_scalar;
+
+}
+
+/*
+ * compute the bitmasks of L[0, n) (see above)
+ */
+inline void lcp_masks(const uint32_t * L, uint64_t n, uint32_t k, uint64_t * lmin, uint64_t * below){
+
+	static const lcp_kernel_t kernel = lcp_masks_kernel();
+
+	kernel(L, n, k, lmin, below);
+
+}
+
+#endif /* INTERNAL_LCP_KERNEL_HPP_ */
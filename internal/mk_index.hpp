@@ -0,0 +1,258 @@
+/*
+ * mk_index.hpp
+ *
+ * Multi-k cluster index (reads.fasta.mkidx), written by ebwt2clust -I and read by mkidx2clust: the
+ * clusters for any k >= k_min (and any minimum length) can be derived from it, without reading the EGSA.
+ *
+ * Between two consecutive starts of local LCP minima, the LCP array is non-decreasing and then strictly
+ * decreasing (see lcp_clusters.hpp): each such region contains at most one cluster, formed by the
+ * positions of the region with LCP >= k. The clusters for k are therefore obtained by trimming the
+ * clusters for k_min < k at both ends, to the positions with LCP >= k. The only exception is position 0,
+ * which never closes a cluster: a cluster opened there contains also position 1. The index stores the
+ * clusters computed with k_min (before discarding the short ones) and the LCP values of their entries.
+ *
+ * File layout:
+ *
+ * header | one record per cluster: distance of start from the end of the previous cluster, length,
+ * and the LCP values of the entries of the cluster (all varints)
+ *
+ */
+
+#ifndef INTERNAL_MK_INDEX_HPP_
+#define INTERNAL_MK_INDEX_HPP_
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "egsa2.hpp"
+
+using namespace std;
+
+struct mk_index_header{
+
+	char magic[8];
+	uint32_t version;
+	uint32_t k_min;//the index contains the clusters for all k >= k_min
+	uint64_t n;//number of clusters (computed with k_min)
+	uint64_t n_entries;//number of EGSA entries in the clusters
+
+};
+
+static const char mk_index_magic[8] = {'M','K','I','D','X','\0','\0','\0'};
+static const uint32_t mk_index_version = 1;
+
+class mk_index_writer{
+
+public:
+
+	mk_index_writer(string & path, uint32_t k_min) : k_min(k_min){
+
+		out.open(path, ios::out | ios::binary);
+
+		if(not out.is_open()){
+
+			cout << "Error: could not create " << path << endl;
+			exit(1);
+
+		}
+
+		//placeholder, overwritten by close()
+		mk_index_header h = {};
+		out.write((char*)&h, sizeof(mk_index_header));
+
+	}
+
+	~mk_index_writer(){
+
+		if(out.is_open()) close();
+
+	}
+
+	/*
+	 * clusters must be appended in increasing order of start. L contains the LCP values of the entries
+	 * [start, start + length) of the cluster.
+	 */
+	void append(uint64_t start, const uint32_t * L, uint64_t length){
+
+		put_varint(buf, start - base);
+		put_varint(buf, length);
+
+		for(uint64_t j = 0; j < length; ++j) put_varint(buf, L[j]);
+
+		base = start + length;
+		n++;
+		n_entries += length;
+
+		if(buf.size() >= (1<<20)) flush();
+
+	}
+
+	/*
+	 * write the records left and the header
+	 */
+	void close(){
+
+		flush();
+
+		mk_index_header h = {};
+		memcpy(h.magic, mk_index_magic, 8);
+		h.version = mk_index_version;
+		h.k_min = k_min;
+		h.n = n;
+		h.n_entries = n_entries;
+
+		out.seekp(0);
+		out.write((char*)&h, sizeof(mk_index_header));
+
+		out.close();
+
+	}
+
+private:
+
+	void flush(){
+
+		out.write((char*)buf.data(), buf.size());
+		buf.clear();
+
+	}
+
+	ofstream out;
+	vector<uint8_t> buf;
+
+	uint32_t k_min;
+
+	uint64_t base = 0;//end of the last cluster
+	uint64_t n = 0;
+	uint64_t n_entries = 0;
+
+};
+
+class mk_index_reader{
+
+public:
+
+	mk_index_reader(string & path){
+
+		in.open(path, ios::in | ios::binary);
+
+		if(not in.is_open()){
+
+			cout << "Error: could not open " << path << endl;
+			exit(1);
+
+		}
+
+		in.read((char*)&H, sizeof(mk_index_header));
+
+		if(not in or memcmp(H.magic, mk_index_magic, 8) != 0 or H.version != mk_index_version){
+
+			cout << "Error: " << path << " is not a multi-k cluster index." << endl;
+			exit(1);
+
+		}
+
+	}
+
+	uint32_t k_min(){
+
+		return H.k_min;
+
+	}
+
+	/*
+	 * number of clusters in the index
+	 */
+	uint64_t size(){
+
+		return H.n;
+
+	}
+
+	/*
+	 * read the next cluster: its start and the LCP values of its entries. Returns false if there
+	 * are no clusters left.
+	 */
+	bool next(uint64_t & start, vector<uint32_t> & L){
+
+		if(c >= H.n) return false;
+
+		fill();
+		start = base + get_varint(p);
+		uint64_t length = get_varint(p);
+
+		L.resize(length);
+
+		for(uint64_t j = 0; j < length; ++j){
+
+			fill();
+			L[j] = get_varint(p);
+
+		}
+
+		base = start + length;
+		c++;
+
+		return true;
+
+	}
+
+private:
+
+	/*
+	 * make sure that the buffer contains the next two varints
+	 */
+	void fill(){
+
+		uint64_t pos = p - buf.data();
+
+		if(buf_len - pos >= max_record or in.eof()) return;
+
+		memmove(buf.data(), p, buf_len - pos);
+		buf_len -= pos;
+
+		in.read((char*)buf.data() + buf_len, buf.size() - buf_len);
+		buf_len += in.gcount();
+
+		p = buf.data();
+
+	}
+
+	static const uint64_t max_record = 20;
+
+	ifstream in;
+	mk_index_header H = {};
+
+	vector<uint8_t> buf = vector<uint8_t>(1<<20);
+	const uint8_t * p = buf.data();
+	uint64_t buf_len = 0;
+
+	uint64_t c = 0;//number of the next cluster
+	uint64_t base = 0;//end of the previous cluster
+
+};
+
+/*
+ * the cluster for threshold k >= k_min contained in the cluster [start, start + L.size()) of the index:
+ * the positions with LCP >= k (see above). Calls emit(start, length) if it is not empty.
+ */
+template<typename F>
+void derive_cluster(uint64_t start, vector<uint32_t> & L, uint32_t k, F emit){
+
+	uint64_t a = 0;
+	uint64_t b = L.size();
+
+	while(a < b and L[a] < k) a++;
+	while(b > a and L[b-1] < k) b--;
+
+	if(start == 0 and a == 0 and b == 1 and L.size() > 1) b = 2;
+
+	if(b > a) emit(start + a, b - a);
+
+}
+
+#endif /* INTERNAL_MK_INDEX_HPP_ */
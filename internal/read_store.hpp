@@ -0,0 +1,474 @@
+/*
+ * read_store.hpp
+ *
+ * Packed store of the reads of a fasta file (reads.fasta.packed), written by pack_reads and read by
+ * clust2snp: the DNA of any read is accessed by read rank (number of the read in the fasta file,
+ * as in the DA of the EGSA) in O(1), without parsing the fasta file.
+ *
+ * - bases: 2 bits per base (A,C,G,T), least significant bits first. Characters other than A,C,G,T
+ *   are stored as A and listed in the exceptions
+ * - offsets: position of the first base of each read in the concatenation of the reads (n + 1 values)
+ * - exceptions: sorted positions (in the concatenation) of the characters other than A,C,G,T, and the
+ *   characters
+ *
+ * File layout:
+ *
+ * header | bases (padded to a multiple of 8 bytes) | offsets (uint64_t) | exception positions (uint64_t) |
+ * exception characters
+ *
+ * The file is memory-mapped (shared): concurrent processes share it through the page cache.
+ *
+ * read_arena keeps a subset of the reads packed in the same way in memory.
+ */
+
+#ifndef INTERNAL_READ_STORE_HPP_
+#define INTERNAL_READ_STORE_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+struct read_store_header{
+
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t n_reads;
+	uint64_t n_bases;
+	uint64_t n_exceptions;
+	uint64_t fasta_size;//size in bytes of the fasta file (to detect a store that does not match it)
+	int64_t fasta_mtime;//modification time of the fasta file
+
+};
+
+static const char read_store_magic[8] = {'R','S','T','O','R','E','\0','\0'};
+static const uint32_t read_store_version = 2;
+
+/*
+ * bytes taken by n packed bases (padded to a multiple of 8)
+ */
+inline uint64_t packed_size(uint64_t n){
+
+	return ((n + 31) / 32) * 8;
+
+}
+
+/*
+ * append DNA to the packed bases bases[0, n_bases): characters other than A,C,G,T are appended to
+ * the exceptions. The last byte of bases must be the one containing base n_bases - 1 (if any).
+ */
+inline void pack_dna(string & DNA, vector<uint8_t> & bases, uint64_t & n_bases, vector<uint64_t> & exc_pos, vector<char> & exc_char){
+
+	for(auto c : DNA){
+
+		int code;
+
+		switch(c){
+
+			case 'A': code = 0; break;
+			case 'C': code = 1; break;
+			case 'G': code = 2; break;
+			case 'T': code = 3; break;
+			default:
+
+				code = 0;
+				exc_pos.push_back(n_bases);
+				exc_char.push_back(c);
+
+			break;
+
+		}
+
+		if(n_bases % 4 == 0) bases.push_back(0);
+		bases.back() |= code << (2*(n_bases % 4));
+
+		n_bases++;
+
+	}
+
+}
+
+/*
+ * bases [b, e) of the packed bases, with the n_exc exceptions exc_pos/exc_char
+ */
+inline string unpack_dna(const uint8_t * bases, const uint64_t * exc_pos, const char * exc_char, uint64_t n_exc, uint64_t b, uint64_t e){
+
+	string s(e - b, 'A');
+
+	const char * ACGT = "ACGT";
+
+	for(uint64_t j = b; j < e; ++j) s[j - b] = ACGT[(bases[j/4] >> (2*(j%4))) & 3];
+
+	//characters other than A,C,G,T in [b, e)
+	for(auto x = lower_bound(exc_pos, exc_pos + n_exc, b); x < exc_pos + n_exc and *x < e; ++x)
+		s[*x - b] = exc_char[x - exc_pos];
+
+	return s;
+
+}
+
+/*
+ * bases [b, e) of the packed bases bases[0, n_bytes), copied packed in w[0, (2(e-b)+63)/64) (the base at
+ * position i in bits 2i, 2i+1, as in the store). Returns false (and w is undefined) if [b, e) contains
+ * characters other than A,C,G,T.
+ */
+inline bool copy_packed(const uint8_t * bases, uint64_t n_bytes, const uint64_t * exc_pos, uint64_t n_exc, uint64_t b, uint64_t e, uint64_t * w){
+
+	auto x = lower_bound(exc_pos, exc_pos + n_exc, b);
+	if(x < exc_pos + n_exc and *x < e) return false;
+
+	for(uint64_t bit = 2*b; bit < 2*e; bit += 64){
+
+		//64 bits starting at bit (a multiple of 2): 8 bytes, plus the bits of the 9th byte
+		uint64_t byte = bit / 8;
+		uint64_t v = 0;
+
+		memcpy(&v, bases + byte, n_bytes - byte < 8 ? n_bytes - byte : 8);
+		v >>= bit % 8;
+
+		if(bit % 8 != 0 and byte + 8 < n_bytes) v |= uint64_t(bases[byte + 8]) << (64 - bit % 8);
+
+		if(2*e - bit < 64) v &= (uint64_t(1) << (2*e - bit)) - 1;
+
+		*w++ = v;
+
+	}
+
+	return true;
+
+}
+
+/*
+ * writes a read store, one read at a time
+ */
+class read_store_writer{
+
+public:
+
+	read_store_writer(string & path){
+
+		out.open(path, ios::out | ios::binary);
+
+		if(not out.is_open()){
+
+			cout << "Error: could not create " << path << endl;
+			exit(1);
+
+		}
+
+		//placeholder, overwritten by close()
+		read_store_header h = {};
+		out.write((char*)&h, sizeof(read_store_header));
+
+		offsets.push_back(0);
+
+	}
+
+	void append(string & DNA){
+
+		pack_dna(DNA, buf, n_bases, exc_pos, exc_char);
+
+		offsets.push_back(n_bases);
+
+		if(buf.size() >= (1<<20)) flush(false);
+
+	}
+
+	/*
+	 * write the bases left, the offsets, the exceptions, and the header. fasta_size and fasta_mtime
+	 * identify the fasta file the reads were read from.
+	 */
+	void close(uint64_t fasta_size, int64_t fasta_mtime){
+
+		flush();
+
+		//padding
+		for(uint64_t j = (n_bases + 3) / 4; j < packed_size(n_bases); ++j) out.put(0);
+
+		out.write((char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+		out.write((char*)exc_pos.data(), exc_pos.size() * sizeof(uint64_t));
+		out.write((char*)exc_char.data(), exc_char.size());
+
+		read_store_header h = {};
+		memcpy(h.magic, read_store_magic, 8);
+		h.version = read_store_version;
+		h.n_reads = offsets.size() - 1;
+		h.n_bases = n_bases;
+		h.n_exceptions = exc_pos.size();
+		h.fasta_size = fasta_size;
+		h.fasta_mtime = fasta_mtime;
+
+		out.seekp(0);
+		out.write((char*)&h, sizeof(read_store_header));
+
+		out.close();
+
+	}
+
+	uint64_t reads(){
+
+		return offsets.size() - 1;
+
+	}
+
+	uint64_t bases(){
+
+		return n_bases;
+
+	}
+
+private:
+
+	/*
+	 * write the packed bases. Unless all is true, the last byte is kept if it is not full.
+	 */
+	void flush(bool all = true){
+
+		uint64_t m = all or n_bases % 4 == 0 ? buf.size() : buf.size() - 1;
+
+		out.write((char*)buf.data(), m);
+		buf.erase(buf.begin(), buf.begin() + m);
+
+	}
+
+	ofstream out;
+
+	vector<uint8_t> buf;//packed bases not yet written
+	vector<uint64_t> offsets;
+	vector<uint64_t> exc_pos;
+	vector<char> exc_char;
+
+	uint64_t n_bases = 0;
+
+};
+
+/*
+ * read-only access to a read store
+ */
+class read_store{
+
+public:
+
+	read_store(){}
+
+	~read_store(){
+
+		if(ptr != NULL) munmap((void*)ptr, len);
+
+	}
+
+	/*
+	 * map the store. Returns false if the file does not exist or is not a valid read store.
+	 */
+	bool open(string & path){
+
+		int fd = ::open(path.c_str(), O_RDONLY);
+
+		if(fd < 0) return false;
+
+		struct stat st;
+
+		if(fstat(fd, &st) != 0 or uint64_t(st.st_size) < sizeof(read_store_header)){
+
+			::close(fd);
+			return false;
+
+		}
+
+		len = st.st_size;
+
+		void * p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+
+		if(p == MAP_FAILED) return false;
+
+		ptr = (const uint8_t*)p;
+		memcpy(&H, ptr, sizeof(read_store_header));
+
+		uint64_t packed_bytes = packed_size(H.n_bases);
+
+		if(	memcmp(H.magic, read_store_magic, 8) != 0 or H.version != read_store_version or
+			len != sizeof(read_store_header) + packed_bytes + (H.n_reads + 1 + H.n_exceptions) * sizeof(uint64_t) + H.n_exceptions){
+
+			munmap((void*)ptr, len);
+			ptr = NULL;
+
+			return false;
+
+		}
+
+		bases = ptr + sizeof(read_store_header);
+		offsets = (const uint64_t*)(bases + packed_bytes);
+		exc_pos = offsets + H.n_reads + 1;
+		exc_char = (const char*)(exc_pos + H.n_exceptions);
+
+		return true;
+
+	}
+
+	/*
+	 * number of reads
+	 */
+	uint64_t size(){
+
+		return H.n_reads;
+
+	}
+
+	uint64_t fasta_size(){
+
+		return H.fasta_size;
+
+	}
+
+	int64_t fasta_mtime(){
+
+		return H.fasta_mtime;
+
+	}
+
+	uint64_t length(uint64_t r){
+
+		return offsets[r+1] - offsets[r];
+
+	}
+
+	/*
+	 * DNA of read r from position pos, at most len characters (as string::substr)
+	 */
+	string substr(uint64_t r, uint64_t pos, uint64_t len){
+
+		uint64_t b = offsets[r] + pos;
+		uint64_t e = offsets[r+1];
+
+		if(b >= e) return string();
+
+		e = len < e - b ? b + len : e;
+
+		return unpack_dna(bases, exc_pos, exc_char, H.n_exceptions, b, e);
+
+	}
+
+	/*
+	 * bases [pos, pos + len) of read r, packed 2 bits per base in w (see copy_packed). Returns false if
+	 * the read is shorter or if the bases contain characters other than A,C,G,T.
+	 */
+	bool packed_substr(uint64_t r, uint64_t pos, uint64_t len, uint64_t * w){
+
+		uint64_t b = offsets[r] + pos;
+
+		if(pos + len > length(r)) return false;
+
+		return copy_packed(bases, packed_size(H.n_bases), exc_pos, H.n_exceptions, b, b + len, w);
+
+	}
+
+private:
+
+	const uint8_t * ptr = NULL;
+	uint64_t len = 0;
+
+	read_store_header H = {};
+
+	const uint8_t * bases = NULL;
+	const uint64_t * offsets = NULL;
+	const uint64_t * exc_pos = NULL;
+	const char * exc_char = NULL;
+
+};
+
+/*
+ * a subset of the reads, packed in memory: the memory used depends only on the reads stored. Reads
+ * are appended in increasing order of rank and accessed by rank (binary search on the ranks stored).
+ */
+class read_arena{
+
+public:
+
+	read_arena(){
+
+		offsets.push_back(0);
+
+	}
+
+	/*
+	 * append the DNA of read with rank r (larger than the ranks already appended)
+	 */
+	void append(uint64_t r, string & DNA){
+
+		ranks.push_back(r);
+
+		pack_dna(DNA, bases, n_bases, exc_pos, exc_char);
+
+		offsets.push_back(n_bases);
+
+	}
+
+	/*
+	 * number of reads
+	 */
+	uint64_t size(){
+
+		return ranks.size();
+
+	}
+
+	/*
+	 * DNA of the read with rank r (which must have been appended) from position pos, at most len
+	 * characters (as string::substr)
+	 */
+	string substr(uint64_t r, uint64_t pos, uint64_t len){
+
+		uint64_t i = lower_bound(ranks.begin(), ranks.end(), r) - ranks.begin();
+
+		uint64_t b = offsets[i] + pos;
+		uint64_t e = offsets[i+1];
+
+		if(b >= e) return string();
+
+		e = len < e - b ? b + len : e;
+
+		return unpack_dna(bases.data(), exc_pos.data(), exc_char.data(), exc_pos.size(), b, e);
+
+	}
+
+	/*
+	 * as read_store::packed_substr
+	 */
+	bool packed_substr(uint64_t r, uint64_t pos, uint64_t len, uint64_t * w){
+
+		uint64_t i = lower_bound(ranks.begin(), ranks.end(), r) - ranks.begin();
+
+		uint64_t b = offsets[i] + pos;
+
+		if(b + len > offsets[i+1]) return false;
+
+		return copy_packed(bases.data(), bases.size(), exc_pos.data(), exc_pos.size(), b, b + len, w);
+
+	}
+
+private:
+
+	vector<uint64_t> ranks;//sorted
+	vector<uint64_t> offsets;//first base of each read (+ the total number of bases)
+
+	vector<uint8_t> bases;
+	uint64_t n_bases = 0;
+
+	vector<uint64_t> exc_pos;
+	vector<char> exc_char;
+
+};
+
+#endif /* INTERNAL_READ_STORE_HPP_ */
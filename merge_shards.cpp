@@ -0,0 +1,166 @@
+// Copyright (c) 2018, Nicola Prezza.  All rights reserved.
+// Use of this source code is governed
+// by a MIT license that can be found in the LICENSE file.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include "internal/clusters.hpp"
+#include <unistd.h>
+
+using namespace std;
+
+string output;
+
+void help(){
+
+	cout << "merge_shards [options] <shard 1> <shard 2> ... <shard N>" << endl <<
+	"Options:" << endl <<
+	"-h         Print this help" << endl <<
+	"-o <arg>   Output file (REQUIRED)" << endl << endl <<
+
+	"\nMerges the outputs of the shards of a run of ebwt2clust (-S i/N, clusters files) or of clust2snp" << endl <<
+	"(-S i/N, .snp files), given in order of shard number. The result is the same as the one of a run" << endl <<
+	"on a single node: clusters are concatenated (and their statistics recomputed), variants are" << endl <<
+	"concatenated and renumbered." << endl;
+	 exit(0);
+}
+
+/*
+ * concatenate clusters files. The clusters of each shard follow those of the previous ones.
+ */
+void merge_clusters(vector<string> & shards){
+
+	clusters_writer out(output);
+
+	uint64_t last_end = 0;
+
+	for(auto path : shards){
+
+		clusters_reader in(path);
+
+		uint64_t start, length;
+
+		while(in.next(start, length)){
+
+			if(start < last_end){
+
+				cout << "Error: the clusters of " << path << " overlap those of the previous shards (shards must be given in order)." << endl;
+				exit(1);
+
+			}
+
+			out.append(start, length);
+			last_end = start + length;
+
+		}
+
+	}
+
+	out.close();
+
+	cout << "Done. " << out.size() << " clusters saved to " << output << endl;
+
+}
+
+/*
+ * concatenate .snp files: the variant numbers of each shard (the number after "_path_" in the
+ * read names) are shifted by the number of variants in the previous shards.
+ */
+void merge_snp(vector<string> & shards){
+
+	ofstream out(output);
+
+	if(not out.is_open()){
+
+		cout << "Error: could not create " << output << endl;
+		exit(1);
+
+	}
+
+	const string tag = "_path_";
+
+	uint64_t offset = 0;//variants in the previous shards
+
+	for(auto path : shards){
+
+		ifstream in(path);
+
+		if(not in.is_open()){
+
+			cout << "Error: could not open " << path << endl;
+			exit(1);
+
+		}
+
+		uint64_t max_id = 0;
+		string line;
+
+		while(getline(in, line)){
+
+			auto p = line.find(tag);
+
+			if(line.size() > 0 and line[0] == '>' and p != string::npos){
+
+				p += tag.size();
+				auto q = line.find('|', p);
+
+				uint64_t id = stoull(line.substr(p, q - p));
+				max_id = id > max_id ? id : max_id;
+
+				line = line.substr(0, p) + to_string(id + offset) + (q != string::npos ? line.substr(q) : "");
+
+			}
+
+			out << line << endl;
+
+		}
+
+		offset += max_id;
+
+	}
+
+	cout << "Done. " << offset << " variants saved to " << output << endl;
+
+}
+
+int main(int argc, char** argv){
+
+	if(argc < 2) help();
+
+	int opt;
+	while ((opt = getopt(argc, argv, "ho:")) != -1){
+		switch (opt){
+			case 'h':
+				help();
+			break;
+			case 'o':
+				output = string(optarg);
+			break;
+			default:
+				help();
+			return -1;
+		}
+	}
+
+	vector<string> shards;
+	for(int i = optind; i < argc; ++i) shards.push_back(string(argv[i]));
+
+	if(output.compare("")==0 or shards.size() == 0) help();
+
+	//clusters files are binary: a .snp file starts with '>' (or is empty)
+	ifstream first(shards[0]);
+	int c = first.peek();
+	first.close();
+
+	if(c == '>' or c == EOF){
+
+		merge_snp(shards);
+
+	}else{
+
+		merge_clusters(shards);
+
+	}
+
+}
@@ -0,0 +1,115 @@
+// Copyright (c) 2018, Nicola Prezza.  All rights reserved.
+// Use of this source code is governed
+// by a MIT license that can be found in the LICENSE file.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include "internal/clusters.hpp"
+#include "internal/mk_index.hpp"
+#include <unistd.h>
+
+using namespace std;
+
+string input;
+string output;//output file (default: input.clusters)
+
+int min_def = 2; //Discard clusters smaller than this value
+int K_def = 16; //require an LCP of at least k inside clusters
+
+int k = 0;
+int min_len = 0;
+
+void help(){
+
+	cout << "mkidx2clust [options]" << endl <<
+	"Options:" << endl <<
+	"-h         Print this help" << endl <<
+	"-i <arg>   Input fasta file (REQUIRED)" << endl <<
+	"-o <arg>   Output clusters file (default: input file name with extension .clusters)." << endl <<
+	"-k <arg>   Minimum LCP required in clusters (default: " << K_def << "). Must be at least the value" << endl <<
+	"           used by ebwt2clust to build the index." << endl <<
+	"-m <arg>   Discard clusters smaller than this value (default: " << min_def << ")" << endl << endl <<
+
+	"\nComputes the clusters file of the input reads for the given -k and -m from the multi-k cluster" << endl <<
+	"index reads.fasta.mkidx (built with ebwt2clust -I), without reading the EGSA. The output is" << endl <<
+	"identical to the one of ebwt2clust with the same -k and -m." << endl;
+	 exit(0);
+}
+
+int main(int argc, char** argv){
+
+	if(argc < 2) help();
+
+	int opt;
+	while ((opt = getopt(argc, argv, "hi:o:k:m:")) != -1){
+		switch (opt){
+			case 'h':
+				help();
+			break;
+			case 'i':
+				input = string(optarg);
+			break;
+			case 'o':
+				output = string(optarg);
+			break;
+			case 'k':
+				k = atoi(optarg);
+			break;
+			case 'm':
+				min_len = atoi(optarg);
+			break;
+			default:
+				help();
+			return -1;
+		}
+	}
+
+	k = k==0?K_def:k;
+	min_len = min_len==0?min_def:min_len;
+
+	if(input.compare("")==0) help();
+
+	string filename_index = input;
+	filename_index.append(".mkidx");
+
+	mk_index_reader index(filename_index);
+
+	if(k < index.k_min()){
+
+		cout << "Error: " << filename_index << " contains the clusters for k >= " << index.k_min() << " only." << endl;
+		exit(1);
+
+	}
+
+	cout << "This is mkidx2clust. Input file: " << filename_index << endl;
+
+	string filename_out = output;
+
+	if(filename_out.compare("")==0){
+
+		filename_out = input;
+		filename_out.append(".clusters");
+
+	}
+
+	clusters_writer out(filename_out);
+
+	uint64_t start;
+	vector<uint32_t> L;
+
+	while(index.next(start, L)){
+
+		derive_cluster(start, L, k, [&](uint64_t s, uint64_t length){
+
+			if(length >= min_len) out.append(s, length);
+
+		});
+
+	}
+
+	out.close();
+
+	cout << "Done. " << out.size() << " clusters saved to output file." << endl;
+
+}
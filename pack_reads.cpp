@@ -0,0 +1,113 @@
+// Copyright (c) 2018, Nicola Prezza.  All rights reserved.
+// Use of this source code is governed
+// by a MIT license that can be found in the LICENSE file.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include "internal/read_store.hpp"
+#include <unistd.h>
+
+using namespace std;
+
+string input;
+
+void help(){
+
+	cout << "pack_reads [options]" << endl <<
+	"Options:" << endl <<
+	"-h         Print this help" << endl <<
+	"-i <arg>   Input fasta file (REQUIRED)" << endl << endl <<
+
+	"\nStores the reads of the input fasta file in reads.fasta.packed (2 bits per base, with an offset table" << endl <<
+	"by read rank). When reads.fasta.packed exists, clust2snp reads the DNA of the reads from it instead of" << endl <<
+	"parsing the fasta file." << endl;
+	 exit(0);
+}
+
+int main(int argc, char** argv){
+
+	if(argc < 2) help();
+
+	int opt;
+	while ((opt = getopt(argc, argv, "hi:")) != -1){
+		switch (opt){
+			case 'h':
+				help();
+			break;
+			case 'i':
+				input = string(optarg);
+			break;
+			default:
+				help();
+			return -1;
+		}
+	}
+
+	if(input.compare("")==0) help();
+
+	string filename_out = input;
+	filename_out.append(".packed");
+
+	{
+
+		ifstream ifs(filename_out);
+
+		if(ifs.good()){
+
+			cout << "Error: " << filename_out << " already exists. Remove it first." << endl;
+			exit(1);
+
+		}
+
+	}
+
+	ifstream fasta(input, ios::in | ios::ate);
+
+	if(not fasta.is_open()){
+
+		cout << "Error: could not open " << input << endl;
+		exit(1);
+
+	}
+
+	uint64_t fasta_size = fasta.tellg();
+	fasta.seekg(0);
+
+	struct stat st;
+	int64_t fasta_mtime = stat(input.c_str(), &st) == 0 ? st.st_mtime : 0;
+
+	cout << "This is pack_reads. Input file: " << input << endl;
+
+	read_store_writer out(filename_out);
+
+	string line;
+	string DNA;
+
+	//get read ID
+	getline(fasta,line);
+
+	while(fasta){
+
+		//read DNA, as in clust2snp: skip newlines, append DNA segments
+		getline(fasta,line);
+		DNA = line;
+
+		while(not fasta.eof() && line[0] != '>'){
+
+			getline(fasta,line);
+			if(line[0] != '>') DNA.append(line);
+
+		}
+
+		out.append(DNA);
+
+		if(fasta.eof()) break;
+
+	}
+
+	out.close(fasta_size, fasta_mtime);
+
+	cout << "Done. " << out.reads() << " reads (" << out.bases() << " bases) saved to " << filename_out << endl;
+
+}
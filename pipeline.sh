@@ -4,7 +4,7 @@
 # 1.  Converts input reads to fasta -> reads1.fasta reads2.fasta 
 # 2.  Adds the reverse complements to the reads and concatenates the two read files -> reads1.reads2.frc.fasta
 # 3.  Builds EGSA -> reads1.reads2.frc.fasta.gesa
-# 4.  Run ebwt2clust -> reads1.reads2.frc.fasta.clusters 
+# 4.  Run ebwt2clust -> reads1.reads2.frc.fasta.clusters (while the EGSA is being built, if both are missing)
 # 5.  Run clust2snp -> reads1.reads2.frc.snp
 # 6.  Run snp2fastq -> reads1.reads2.frc.snp.fastq
 # 7.  Builds BWA MEM index of reference.fasta -> reference.fasta.{amb,ann,bwt,fai,pac,sa} files
@@ -99,9 +99,50 @@ fi
 if [ ! -f ${WD}/${READS1}.${READS2}.frc.fasta.gesa ]; then
 	if [ ! -f ${WD}/${READS1}.${READS2}.frc.fasta.out ]; then
 		echo "building EGSA ..."
+
+		# if the clusters have not been computed yet, egsa writes the EGSA to a named pipe: the EGSA
+		# is saved to disk and streamed to ebwt2clust (step 4) at the same time, without reading it back
+		if [ ! -f ${WD}/${READS1}.${READS2}.frc.fasta.clusters ]; then
+			FIFO=${WD}/${READS1}.${READS2}.frc.fasta.${GSAtext}.${GSAsuff}.${LCP}.1.gesa
+			rm -f ${FIFO}
+			mkfifo ${FIFO}
+			# the named pipe is removed on every exit path
+			trap 'rm -f ${FIFO}' EXIT
+			trap 'exit 1' INT TERM
+			echo "running ebwt2clust on the EGSA stream ..."
+			# pipefail: the stream fails if either tee (e.g. disk full while saving the EGSA) or ebwt2clust fails
+			( set -o pipefail; tee ${WD}/${READS1}.${READS2}.frc.fasta.gesa < ${FIFO} | /usr/bin/time -v ebwt2clust -i - -o ${WD}/${READS1}.${READS2}.frc.fasta.clusters -m $((M*2)) -x ${LCP} -y ${GSAtext} -z ${GSAsuff} > ${TIME_EBWTCLUST} 2>&1 ) &
+			STREAM_PID=$!
+		fi
+
 		/usr/bin/time -v egsa -vvv ${WD}/${READS1}.${READS2}.frc.fasta 0 > ${TIME_EGSA} 2>&1
 		#/usr/bin/time -v gsufsort ${WD}/${READS1}.${READS2}.frc.fasta --gesa ${GSAtext} ${GSAsuff} ${LCP} > ${TIME_EGSA} 2>&1
-		mv ${WD}/${READS1}.${READS2}.frc.fasta.${GSAtext}.${GSAsuff}.${LCP}.1.gesa ${WD}/${READS1}.${READS2}.frc.fasta.gesa
+		EGSA_STATUS=$?
+
+		if [ -n "${STREAM_PID}" ]; then
+			# if egsa never opened the pipe, tee is still waiting in open(): unblock it (it then reads an
+			# empty stream). Opening the pipe read-write never blocks. Once egsa has exited, the stream
+			# reaches its end and the background pipeline terminates
+			exec 3<>${FIFO}
+			exec 3>&-
+			if [ ${EGSA_STATUS} -ne 0 ]; then
+				echo "Error: egsa failed (see "${TIME_EGSA}")."
+				wait ${STREAM_PID}
+				rm -f ${WD}/${READS1}.${READS2}.frc.fasta.gesa ${WD}/${READS1}.${READS2}.frc.fasta.clusters*
+				exit 1
+			fi
+			if ! wait ${STREAM_PID}; then
+				echo "Error: saving the EGSA stream or running ebwt2clust on it failed (see "${TIME_EBWTCLUST}")."
+				rm -f ${WD}/${READS1}.${READS2}.frc.fasta.gesa ${WD}/${READS1}.${READS2}.frc.fasta.clusters*
+				exit 1
+			fi
+			rm -f ${FIFO}
+		elif [ ${EGSA_STATUS} -ne 0 ]; then
+			echo "Error: egsa failed (see "${TIME_EGSA}")."
+			exit 1
+		else
+			mv ${WD}/${READS1}.${READS2}.frc.fasta.${GSAtext}.${GSAsuff}.${LCP}.1.gesa ${WD}/${READS1}.${READS2}.frc.fasta.gesa
+		fi
 		
 		rm -rf ${WD}/tmp
 		rm -rf ${WD}/partition
@@ -0,0 +1,229 @@
+/*
+ * checks that the fused mode of clust2snp (-f) gives the same output as ebwt2clust + clust2snp, with the
+ * default and with other bounds on the cluster length (-M), and that -M changes the clusters analyzed.
+ *
+ * A small dataset is built in the working directory: reads of two individuals (and their reverse
+ * complements) differing by a few SNPs and an indel, and the EGSA of the reads (suffixes sorted naively).
+ *
+ * usage: fused_test <ebwt2clust executable> <clust2snp executable>
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <random>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+mt19937_64 rng(7);
+
+string random_dna(uint64_t n){
+
+	string s;
+
+	for(uint64_t j = 0; j < n; ++j) s += "ACGT"[rng() % 4];
+
+	return s;
+
+}
+
+string rc(string & s){
+
+	string r(s.rbegin(), s.rend());
+
+	for(auto & c : r) c = c == 'A' ? 'T' : c == 'C' ? 'G' : c == 'G' ? 'C' : 'A';
+
+	return r;
+
+}
+
+/*
+ * n reads of length L sampled from g (some with a sequencing error), followed by their reverse complements
+ */
+vector<string> sample_reads(string & g, uint64_t n, uint64_t L){
+
+	vector<string> R;
+
+	for(uint64_t j = 0; j < n; ++j){
+
+		string r = g.substr(rng() % (g.size() - L + 1), L);
+
+		if(rng() % 10 < 3) r[rng() % L] = "ACGT"[rng() % 4];
+
+		R.push_back(r);
+
+	}
+
+	for(uint64_t j = 0; j < n; ++j) R.push_back(rc(R[j]));
+
+	return R;
+
+}
+
+/*
+ * writes reads.fasta and reads.fasta.gesa (read number: 4 bytes, position in read: 1 byte, LCP: 1 byte,
+ * BWT: 1 byte). Returns the number of reads of the first individual.
+ */
+uint64_t make_dataset(){
+
+	uint64_t G = 3000;
+	uint64_t L = 100;
+	uint64_t n = G * 20 / L;
+
+	string g1 = random_dna(G);
+	string g2 = g1;
+
+	for(int s = 0; s < 10; ++s){
+
+		uint64_t p = 200 + rng() % (G - 400);
+		g2[p] = "ACGT"[(string("ACGT").find(g2[p]) + 1 + rng() % 3) % 4];
+
+	}
+
+	g2.insert(G/2, "GTA");
+
+	vector<string> R = sample_reads(g1, n, L);
+	vector<string> R2 = sample_reads(g2, n, L);
+
+	uint64_t nr_reads1 = R.size();
+	R.insert(R.end(), R2.begin(), R2.end());
+
+	ofstream fasta("reads.fasta");
+
+	for(uint64_t i = 0; i < R.size(); ++i) fasta << ">r" << i << endl << R[i] << endl;
+
+	fasta.close();
+
+	//all suffixes (including the empty ones), sorted by suffix and then by read number
+	vector<pair<uint32_t, uint32_t> > S;
+
+	for(uint32_t i = 0; i < R.size(); ++i)
+		for(uint32_t p = 0; p <= R[i].size(); ++p)
+			S.push_back({i, p});
+
+	auto suffix = [&](pair<uint32_t, uint32_t> & s){ return R[s.first].c_str() + s.second; };
+
+	sort(S.begin(), S.end(), [&](pair<uint32_t, uint32_t> a, pair<uint32_t, uint32_t> b){
+
+		int c = strcmp(suffix(a), suffix(b));
+		return c < 0 or (c == 0 and a.first < b.first);
+
+	});
+
+	ofstream gesa("reads.fasta.gesa", ios::binary);
+
+	for(uint64_t j = 0; j < S.size(); ++j){
+
+		uint8_t lcp = 0;
+
+		if(j > 0){
+
+			const char * a = suffix(S[j-1]);
+			const char * b = suffix(S[j]);
+
+			while(a[lcp] != 0 and a[lcp] == b[lcp]) lcp++;
+
+		}
+
+		uint32_t text = S[j].first;
+		uint8_t suff = S[j].second;
+		uint8_t bwt = suff > 0 ? R[text][suff - 1] : '$';
+
+		gesa.write((char*)&text, 4);
+		gesa.write((char*)&suff, 1);
+		gesa.write((char*)&lcp, 1);
+		gesa.write((char*)&bwt, 1);
+
+	}
+
+	gesa.close();
+
+	return nr_reads1;
+
+}
+
+string read_file(string path){
+
+	ifstream in(path);
+	stringstream ss;
+	ss << in.rdbuf();
+
+	return ss.str();
+
+}
+
+/*
+ * runs the command, its output going to log. Returns false if it fails
+ */
+bool run(string command){
+
+	if(system((command + " > fused_test.log 2>&1").c_str()) == 0) return true;
+
+	cout << "FAILED: " << command << endl << read_file("fused_test.log");
+
+	return false;
+
+}
+
+int main(int argc, char** argv){
+
+	if(argc < 3){
+
+		cout << "usage: fused_test <ebwt2clust executable> <clust2snp executable>" << endl;
+		return 1;
+
+	}
+
+	string ebwt2clust = argv[1];
+	string clust2snp = argv[2];
+
+	uint64_t nr_reads1 = make_dataset();
+
+	if(not run(ebwt2clust + " -i reads.fasta")) return 1;
+
+	uint64_t failures = 0;
+	vector<string> outputs;
+
+	//the default bound, bounds within and above the cluster lengths of the dataset (about 40 entries)
+	for(string M : {"", "28", "35", "500"}){
+
+		string options = " -i reads.fasta -n " + to_string(nr_reads1) + (M == "" ? "" : " -M " + M);
+
+		if(not run(clust2snp + options)) return 1;
+		string two_steps = read_file("reads.snp");
+
+		if(not run(clust2snp + options + " -f")) return 1;
+		string fused = read_file("reads.snp");
+
+		if(fused != two_steps or fused.empty()){
+
+			cout << "FAILED: the output of -f" << (M == "" ? "" : " -M " + M) << " differs from ebwt2clust + clust2snp." << endl;
+			failures++;
+
+		}
+
+		outputs.push_back(fused);
+
+	}
+
+	//a bound below the length of most clusters discards variants
+	if(outputs[1].size() >= outputs[0].size()){
+
+		cout << "FAILED: -M 28 does not change the clusters analyzed." << endl;
+		failures++;
+
+	}
+
+	if(failures > 0) return 1;
+
+	cout << "All checks passed." << endl;
+
+	return 0;
+
+}
@@ -0,0 +1,299 @@
+/*
+ * checks the LCP kernels of internal/lcp_kernel.hpp (scalar, SSE4.1, AVX2) against the scalar rule, and
+ * the clusters computed in chunks by scan_chunk/stitch/close_last against the original scalar scan of
+ * ebwt2clust. LCP arrays: random values of each LCP byte width, plateaus, values around k, and lengths
+ * and chunk sizes around the vector widths and the 64-bit words of the masks.
+ */
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <string>
+#include "internal/lcp_kernel.hpp"
+#include "internal/lcp_clusters.hpp"
+
+using namespace std;
+
+mt19937_64 rng(42);
+
+uint64_t failures = 0;
+uint64_t checks = 0;
+
+void fail(string what, uint64_t n, uint32_t k){
+
+	if(failures++ < 10) cout << "FAILED: " << what << " (n = " << n << ", k = " << k << ")" << endl;
+
+}
+
+/*
+ * the rule, one position at a time: bit j of lmin iff L[j-1] > L[j] <= L[j+1], bit j of below iff L[j] < k
+ */
+bool check_masks(lcp_kernel_t kernel, string name, vector<uint32_t> & V, uint32_t k){
+
+	//V[0] and V[n+1] are the neighbours of the block
+	uint64_t n = V.size() - 2;
+	uint64_t words = (n + 63) / 64;
+
+	vector<uint64_t> lmin(words + 1, 0xABABABABABABABABULL);
+	vector<uint64_t> below(words + 1, 0xABABABABABABABABULL);
+
+	kernel(V.data() + 1, n, k, lmin.data(), below.data());
+
+	checks++;
+
+	for(uint64_t j = 0; j < n; ++j){
+
+		bool is_lmin = V[j] > V[j+1] and V[j+1] <= V[j+2];
+		bool is_below = V[j+1] < k;
+
+		if(((lmin[j/64] >> (j%64)) & 1) != is_lmin or ((below[j/64] >> (j%64)) & 1) != is_below){
+
+			fail(name + " masks differ at position " + to_string(j), n, k);
+			return false;
+
+		}
+
+	}
+
+	//bits past n in the last word are 0, and the following word is not written
+	if(n % 64 != 0 and ((lmin[words-1] >> (n%64)) != 0 or (below[words-1] >> (n%64)) != 0)){
+
+		fail(name + " sets bits past the end of the block", n, k);
+		return false;
+
+	}
+
+	if(lmin[words] != 0xABABABABABABABABULL or below[words] != 0xABABABABABABABABULL){
+
+		fail(name + " writes past the masks", n, k);
+		return false;
+
+	}
+
+	return true;
+
+}
+
+/*
+ * clusters of L[0, n) computed as cluster_lm in the original ebwt2clust: one entry at a time, the entry
+ * following the last one having LCP 0
+ */
+vector<pair<uint64_t, uint64_t> > clusters_scalar(vector<uint32_t> & L, uint32_t k){
+
+	uint64_t null = ~uint64_t(0);
+	uint64_t n = L.size();
+
+	vector<pair<uint64_t, uint64_t> > out;
+
+	auto lcp = [&](uint64_t i){ return i < n ? L[i] : 0; };
+
+	uint64_t e1 = lcp(0);
+	uint64_t e2 = lcp(1);
+
+	uint64_t start = e1 >= k ? 0 : e2 >= k ? 1 : null;
+	uint64_t i = 1;
+
+	for(uint64_t j = 2; j <= n; ++j){
+
+		uint64_t e3 = lcp(j);
+
+		if(start != null and ((e1 > e2 and e2 <= e3) or e3 < k)){
+
+			out.push_back({start, i});
+			start = null;
+
+		}
+
+		e1 = e2;
+		e2 = e3;
+		++i;
+
+		if(start == null and e2 >= k) start = i;
+
+	}
+
+	if(start != null) out.push_back({start, i});
+
+	return out;
+
+}
+
+/*
+ * the same clusters, with chunks of the given sizes (the last one extends to n), as cluster_lm
+ */
+vector<pair<uint64_t, uint64_t> > clusters_chunks(vector<uint32_t> & L, uint32_t k, vector<uint64_t> & sizes){
+
+	uint64_t null = ~uint64_t(0);
+	uint64_t n = L.size();
+
+	vector<pair<uint64_t, uint64_t> > out;
+
+	auto emit = [&](uint64_t s, uint64_t e){ out.push_back({s, e}); };
+
+	chunk_clusters R;
+	uint64_t start = null;
+	uint64_t a = 0;
+
+	for(uint64_t c = 0; a < n; ++c){
+
+		uint64_t b = c + 1 < sizes.size() and a + sizes[c] < n ? a + sizes[c] : n;
+
+		//lcp[j] = LCP in position a - 1 + j. Position -1 is never read: it holds garbage
+		vector<uint32_t> lcp;
+
+		for(uint64_t p = a; p <= b + 1; ++p)
+			lcp.push_back(p == 0 ? uint32_t(rng()) : p - 1 < n ? L[p - 1] : 0);
+
+		scan_chunk(lcp.data(), a, b, k, R);
+		stitch(R, start, emit);
+
+		a = b;
+
+	}
+
+	close_last(n, start, k, emit);
+
+	return out;
+
+}
+
+void check_clusters(vector<uint32_t> & L, uint32_t k){
+
+	if(L.size() < 2) return;
+
+	auto ref = clusters_scalar(L, k);
+
+	//chunk sizes: random, single entries, around the words of the masks and the vector widths
+	vector<vector<uint64_t> > splits = {{L.size()}, {1}, {3}, {7}, {8}, {63}, {64}, {65}, {128}, {}};
+
+	for(uint64_t c = 0; c < 20; ++c) splits.back().push_back(1 + rng() % 150);
+
+	for(auto & sizes : splits){
+
+		//a single size is repeated
+		if(sizes.size() == 1) sizes = vector<uint64_t>(L.size() / sizes[0] + 1, sizes[0]);
+
+		checks++;
+
+		if(clusters_chunks(L, k, sizes) != ref){
+
+			fail("clusters differ (chunks of " + to_string(sizes[0]) + (sizes.size() > 1 ? ", ..." : "") + ")", L.size(), k);
+			return;
+
+		}
+
+	}
+
+}
+
+/*
+ * the kernels available on this CPU
+ */
+vector<pair<string, lcp_kernel_t> > kernels(){
+
+	vector<pair<string, lcp_kernel_t> > K = {{"scalar", lcp_masks_scalar}};
+
+#ifdef LCP_KERNEL_X86
+
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("sse4.1")) K.push_back({"sse4.1", lcp_masks_sse4});
+	if(__builtin_cpu_supports("avx2")) K.push_back({"avx2", lcp_masks_avx2});
+
+#endif
+
+	return K;
+
+}
+
+/*
+ * LCP array of length n with values in [0, max]:
+ *
+ * 0: random
+ * 1: plateaus (runs of equal values)
+ * 2: values in {k-1, k, k+1}
+ * 3: values in {k-1, k}
+ * 4: slopes and valleys
+ */
+vector<uint32_t> make_lcp(uint64_t n, int type, uint32_t max, uint32_t k){
+
+	vector<uint32_t> L(n);
+
+	auto val = [&](){ return uint32_t(rng() % (uint64_t(max) + 1)); };
+	auto near_k = [&](int d){ int64_t v = int64_t(k) + d; return uint32_t(v < 0 ? 0 : v > max ? max : v); };
+
+	for(uint64_t j = 0; j < n; ++j){
+
+		switch(type){
+
+			case 0: L[j] = val(); break;
+			case 1: L[j] = j > 0 and rng() % 8 != 0 ? L[j-1] : val(); break;
+			case 2: L[j] = near_k(int(rng() % 3) - 1); break;
+			case 3: L[j] = near_k(-int(rng() % 2)); break;
+			default: L[j] = j > 0 and rng() % 16 != 0 ? (rng() % 2 ? (L[j-1] < max ? L[j-1] + 1 : max) : (L[j-1] > 0 ? L[j-1] - 1 : 0)) : val(); break;
+
+		}
+
+	}
+
+	return L;
+
+}
+
+int main(){
+
+	auto K = kernels();
+
+	cout << "Kernels tested:";
+	for(auto & kernel : K) cout << " " << kernel.first;
+	cout << endl;
+
+	//maximum LCP value for each byte width of the LCP integers
+	vector<uint32_t> max_values = {0xFF, 0xFFFF, 0xFFFFFFFF};
+
+	//lengths around the vector widths (4, 8) and the words of the masks (64)
+	vector<uint64_t> lengths;
+	for(uint64_t n = 0; n <= 140; ++n) lengths.push_back(n);
+	for(uint64_t n : {191, 192, 193, 255, 256, 257, 1023, 1024, 1025, 5000}) lengths.push_back(n);
+
+	for(auto max : max_values){
+
+		//k: 0, 1, small, the maximum value, and random
+		vector<uint32_t> ks = {0, 1, 2, 16, max, max - 1, uint32_t(rng() % (uint64_t(max) + 1))};
+
+		for(auto n : lengths){
+
+			for(int type = 0; type < 5; ++type){
+
+				for(auto k : ks){
+
+					auto L = make_lcp(n, type, max, k);
+
+					//the block with its two neighbours
+					vector<uint32_t> V = make_lcp(n + 2, type, max, k);
+					for(uint64_t j = 0; j < n; ++j) V[j+1] = L[j];
+
+					for(auto & kernel : K) check_masks(kernel.second, kernel.first, V, k);
+
+					check_clusters(L, k);
+
+				}
+
+			}
+
+		}
+
+	}
+
+	if(failures > 0){
+
+		cout << failures << " of " << checks << " checks FAILED." << endl;
+		return 1;
+
+	}
+
+	cout << "All " << checks << " checks passed." << endl;
+
+	return 0;
+
+}